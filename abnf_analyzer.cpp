@@ -0,0 +1,197 @@
+#include "abnf_parser.h"
+#include <cassert>
+#include <cctype>
+#include <sstream>
+#include <iomanip>
+
+// static analysis of the generated elements
+
+namespace
+{
+
+void report(std::vector<abnf_diagnostic>& diagnostics, abnf_diagnostic::severity_t severity,
+    const std::string& rulename, const std::string& message)
+{
+    abnf_diagnostic diagnostic;
+    diagnostic.severity = severity;
+    diagnostic.rulename = rulename;
+    diagnostic.message = message;
+    diagnostics.push_back(diagnostic);
+}
+
+std::string print_byte(size_t byte)
+{
+    std::ostringstream sts;
+    if(byte > 0x20 && byte < 0x7f && byte != '\"')
+        sts << "\"" << (char)byte << "\"";
+    else
+        sts << "%x" << std::uppercase << std::hex << std::setw(2) << std::setfill('0') << byte;
+    return sts.str();
+}
+
+}
+
+abnf_first abnf_element::analyze_element(
+    std::vector<abnf_diagnostic>& diagnostics, const std::string& rulename)
+{
+    assert(this->element.get());
+    return this->element->analyze(diagnostics, rulename);
+}
+
+abnf_first abnf_element::analyze(std::vector<abnf_diagnostic>& diagnostics, const std::string& rulename)
+{
+    abnf_first first = this->analyze_element(diagnostics, rulename);
+    if(this->is_option)
+        first.nullable = true;
+    return first;
+}
+
+abnf_first abnf_vals::analyze(std::vector<abnf_diagnostic>&, const std::string&)
+{
+    abnf_first first;
+    first.nullable = false;
+
+    if(this->type == CHAR_VAL)
+    {
+        if(this->char_val.empty())
+            first.nullable = true;
+        else
+        {
+            unsigned char c = (unsigned char)this->char_val[0];
+            first.bytes.set(c);
+            // insensitive literals are folded to lower case
+            if(!this->sensitive && c >= 'a' && c <= 'z')
+                first.bytes.set(c - 'a' + 'A');
+        }
+    }
+    else if(this->type == RANGE_VAL)
+    {
+        // the numerals are compared truncated to char
+        for(int i = this->range.first; i <= this->range.second && !first.bytes.all(); i++)
+            first.bytes.set((unsigned char)i);
+    }
+
+    return first;
+}
+
+abnf_first abnf_class::analyze(std::vector<abnf_diagnostic>&, const std::string&)
+{
+    abnf_first first;
+    first.bytes = this->bytes;
+    first.nullable = false;
+    return first;
+}
+
+abnf_first abnf_repetition::analyze(std::vector<abnf_diagnostic>& diagnostics, const std::string& rulename)
+{
+    if(!this->has_repeat)
+        return this->element.analyze(diagnostics, rulename);
+
+    // bounded repetitions of empty matches end by themselves
+    abnf_first first = this->element.analyze_element(diagnostics, rulename);
+    if(this->repetitions.second == -1 && (first.nullable || this->element.is_optional()))
+    {
+        std::ostringstream sts;
+        this->print(sts);
+
+        // n*[x] matches the same input as *x when x can't match empty input
+        if(!first.nullable)
+        {
+            this->element.remove_option();
+            this->repetitions.first = -1;
+            report(diagnostics, abnf_diagnostic::WARNING, rulename,
+                "optional element repeated without a maximum, rewritten as *: " + sts.str());
+        }
+        else
+        {
+            report(diagnostics, abnf_diagnostic::ERROR, rulename,
+                "unbounded repetition of an element that can match empty input: " + sts.str());
+        }
+    }
+
+    if(this->repetitions.second == 0)
+        first.bytes.reset();
+    if(this->repetitions.first <= 0 || this->element.is_optional())
+        first.nullable = true;
+    return first;
+}
+
+abnf_first abnf_concatenation::analyze(std::vector<abnf_diagnostic>& diagnostics, const std::string& rulename)
+{
+    abnf_first first = this->left.analyze(diagnostics, rulename);
+    for(auto it = this->right.begin(); it != this->right.end(); it++)
+    {
+        // every item is analyzed for the diagnostics
+        abnf_first item = it->analyze(diagnostics, rulename);
+        if(first.nullable)
+        {
+            first.bytes |= item.bytes;
+            first.nullable = item.nullable;
+        }
+    }
+    return first;
+}
+
+abnf_first abnf_alternation::analyze(std::vector<abnf_diagnostic>& diagnostics, const std::string& rulename)
+{
+    std::vector<abnf_first> firsts;
+    firsts.push_back(this->left.analyze(diagnostics, rulename));
+    for(auto it = this->right.begin(); it != this->right.end(); it++)
+        firsts.push_back(it->analyze(diagnostics, rulename));
+
+    abnf_first first = firsts.front();
+    for(size_t i = 1; i < firsts.size(); i++)
+    {
+        first.bytes |= firsts[i].bytes;
+        first.nullable = first.nullable || firsts[i].nullable;
+    }
+
+    for(size_t i = 0; i < firsts.size(); i++)
+    {
+        std::ostringstream sts;
+        sts << "alternative " << (i + 1);
+
+        // elements without predicates always match if they can match empty input
+        if(firsts[i].nullable && i + 1 < firsts.size())
+        {
+            report(diagnostics, abnf_diagnostic::WARNING, rulename,
+                sts.str() + " can match empty input, the alternatives after it are never tried");
+            break;
+        }
+
+        // the later alternative is tried only after the earlier one has failed
+        for(size_t j = i + 1; j < firsts.size(); j++)
+        {
+            std::bitset<256> conflict = firsts[i].bytes & firsts[j].bytes;
+            if(conflict.none())
+                continue;
+
+            size_t byte = 0;
+            while(!conflict.test(byte))
+                byte++;
+            // both cases of a letter conflict for insensitive literals, which are written folded
+            if(isupper((int)byte) && conflict.test(tolower((int)byte)))
+                byte = tolower((int)byte);
+
+            std::ostringstream message;
+            message << sts.str() << " and alternative " << (j + 1)
+                << " can both start with " << print_byte(byte);
+            report(diagnostics, abnf_diagnostic::WARNING, rulename, message.str());
+        }
+    }
+
+    return first;
+}
+
+bool abnf_rule::analyze(std::vector<abnf_diagnostic>& diagnostics)
+{
+    assert(this->generated);
+
+    size_t begin = diagnostics.size();
+    this->first = this->alternation.analyze(diagnostics, this->rulename);
+
+    for(size_t i = begin; i < diagnostics.size(); i++)
+        if(diagnostics[i].severity == abnf_diagnostic::ERROR)
+            return false;
+    return true;
+}
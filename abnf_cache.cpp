@@ -0,0 +1,208 @@
+#include "abnf_cache.h"
+#include <cassert>
+#include <cstring>
+
+const size_t abnf_cache::shard_count;
+
+uint64_t abnf_cache::hash(const char* bytes, size_t size)
+{
+    const uint64_t multiplier = 0x9E3779B97F4A7C15ULL;
+    uint64_t h = size * multiplier;
+
+    // 8 bytes at a time
+    size_t i = 0;
+    for(; i + 8 <= size; i += 8)
+    {
+        uint64_t word;
+        memcpy(&word, bytes + i, 8);
+        h = (h ^ word) * multiplier;
+        h ^= h >> 29;
+    }
+
+    uint64_t tail = 0;
+    for(size_t j = 0; i < size; i++, j += 8)
+        tail |= (uint64_t)(unsigned char)bytes[i] << j;
+    h = (h ^ tail) * multiplier;
+    h ^= h >> 32;
+    return h;
+}
+
+void abnf_cache::shard::evict()
+{
+    assert(this->bytes > 0);
+
+    // there's an unreferenced entry at the latest on the second round
+    for(;;)
+    {
+        size_t i = this->hand;
+        this->hand = (this->hand + 1) % this->slots.size();
+
+        entry& e = this->slots[i];
+        if(!e.bytes)
+            continue;
+        if(e.referenced)
+        {
+            e.referenced = false;
+            continue;
+        }
+
+        this->index.erase(e.hash);
+        this->bytes -= e.bytes;
+        e.bytes = 0;
+        std::string().swap(e.input);
+        std::vector<capture>().swap(e.captures);
+        this->free_slots.push_back(i);
+        return;
+    }
+}
+
+abnf_cache::abnf_cache(const abnf_parser& parser, size_t max_bytes) :
+    prototype(parser),
+    max_shard_bytes(max_bytes / shard_count),
+    hits(0),
+    misses(0)
+{
+}
+
+bool abnf_cache::lookup(shard& s, uint64_t hash, const std::string& input,
+    abnf_machine::result_t& result, std::vector<capture>& captures)
+{
+    std::lock_guard<std::mutex> lock(s.mutex);
+
+    auto it = s.index.find(hash);
+    if(it == s.index.end())
+        return false;
+
+    // a hash collision is a miss
+    entry& e = s.slots[it->second];
+    if(e.input != input)
+        return false;
+
+    e.referenced = true;
+    result = e.result;
+    captures = e.captures;
+    return true;
+}
+
+void abnf_cache::insert(shard& s, uint64_t hash, const std::string& input,
+    abnf_machine::result_t result, const std::vector<capture>& captures)
+{
+    size_t bytes = sizeof(entry) + input.size() + captures.size() * sizeof(capture) +
+        sizeof(std::pair<uint64_t, size_t>) + sizeof(void*);
+    if(bytes > this->max_shard_bytes)
+        return;
+
+    std::lock_guard<std::mutex> lock(s.mutex);
+
+    // another thread may have inserted the input or a colliding one
+    if(s.index.count(hash))
+        return;
+    while(s.bytes + bytes > this->max_shard_bytes)
+        s.evict();
+
+    size_t i;
+    if(!s.free_slots.empty())
+    {
+        i = s.free_slots.back();
+        s.free_slots.pop_back();
+    }
+    else
+    {
+        i = s.slots.size();
+        s.slots.push_back(entry());
+    }
+
+    entry& e = s.slots[i];
+    e.hash = hash;
+    e.input = input;
+    e.result = result;
+    e.captures = captures;
+    e.referenced = false;
+    e.bytes = bytes;
+    s.index[hash] = i;
+    s.bytes += bytes;
+}
+
+void abnf_cache::store_captures(const std::string& input,
+    const std::vector<capture>& captures, matched_patterns_t& out) const
+{
+    const abnf_program& program = this->prototype.get_program();
+    for(auto it = captures.begin(); it != captures.end(); it++)
+        out[program.rules[it->rule].rulename].assign(input, it->begin, it->end - it->begin);
+}
+
+abnf_machine::result_t abnf_cache::run(const std::string& input, matched_patterns_t& out)
+{
+    uint64_t h = hash(input.data(), input.size());
+    // the high bits pick the shard, the low bits the bucket in it
+    shard& s = this->shards[h >> 60];
+
+    abnf_machine::result_t result;
+    std::vector<capture> captures;
+    if(this->lookup(s, h, input, result, captures))
+    {
+        this->hits++;
+        this->store_captures(input, captures, out);
+        return result;
+    }
+    this->misses++;
+
+    boost::shared_ptr<abnf_machine> machine;
+    {
+        std::lock_guard<std::mutex> lock(this->machines_mutex);
+        if(!this->machines.empty())
+        {
+            machine = this->machines.back();
+            this->machines.pop_back();
+        }
+    }
+    if(!machine)
+        machine.reset(new abnf_machine(this->prototype));
+
+    result = machine->run(input, out);
+    if(result == abnf_machine::MATCHED || result == abnf_machine::NOT_MATCHED)
+    {
+        auto& matched = machine->get_captures();
+        for(auto it = matched.begin(); it != matched.end(); it++)
+        {
+            capture c = {it->rule,
+                (size_t)(it->begin - input.begin()), (size_t)(it->end - input.begin())};
+            captures.push_back(c);
+        }
+        this->insert(s, h, input, result, captures);
+    }
+
+    std::lock_guard<std::mutex> lock(this->machines_mutex);
+    this->machines.push_back(machine);
+    return result;
+}
+
+abnf_cache::stats_t abnf_cache::get_stats()
+{
+    stats_t stats;
+    stats.hits = this->hits;
+    stats.misses = this->misses;
+    stats.entries = 0;
+    stats.bytes = 0;
+    for(size_t i = 0; i < shard_count; i++)
+    {
+        std::lock_guard<std::mutex> lock(this->shards[i].mutex);
+        stats.entries += this->shards[i].index.size();
+        stats.bytes += this->shards[i].bytes;
+    }
+    return stats;
+}
+
+void abnf_cache::clear()
+{
+    for(size_t i = 0; i < shard_count; i++)
+    {
+        shard& s = this->shards[i];
+        std::lock_guard<std::mutex> lock(s.mutex);
+        s.index.clear();
+        s.slots.clear();
+        s.free_slots.clear();
+        s.hand = 0;
+        s.bytes = 0;
+    }
+}
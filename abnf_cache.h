@@ -0,0 +1,82 @@
+#pragma once
+
+#include "abnf_machine.h"
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
+#include <cstdint>
+
+// bounded cache of the match results of a generated grammar. inputs are
+// keyed by a hash of their bytes, and the captures are stored as offsets
+// into the input. entries are evicted with the clock algorithm once the
+// memory limit is reached.
+// the cache can be used from multiple threads; the parser must outlive it
+class abnf_cache
+{
+public:
+    struct stats_t
+    {
+        size_t hits, misses, entries, bytes;
+    };
+private:
+    struct capture
+    {
+        int rule;
+        size_t begin, end;
+    };
+    struct entry
+    {
+        uint64_t hash;
+        std::string input;
+        abnf_machine::result_t result;
+        std::vector<capture> captures;
+        // cleared by the clock hand; an entry is evicted if it isn't
+        // used again before the hand comes back
+        bool referenced;
+        // counted against the memory limit; 0 if the slot is free
+        size_t bytes;
+    };
+    struct shard
+    {
+        std::mutex mutex;
+        std::unordered_map<uint64_t, size_t> index;
+        std::vector<entry> slots;
+        std::vector<size_t> free_slots;
+        size_t hand, bytes;
+
+        shard() : hand(0), bytes(0) {}
+        void evict();
+    };
+
+    // picked by the 4 high bits of the hash
+    static const size_t shard_count = 16;
+
+    // compiled once and copied for each thread that runs the grammar
+    const abnf_machine prototype;
+    std::mutex machines_mutex;
+    std::vector<boost::shared_ptr<abnf_machine> > machines;
+
+    shard shards[shard_count];
+    size_t max_shard_bytes;
+    std::atomic<size_t> hits, misses;
+
+    bool lookup(shard&, uint64_t hash, const std::string& input,
+        abnf_machine::result_t&, std::vector<capture>&);
+    void insert(shard&, uint64_t hash, const std::string& input,
+        abnf_machine::result_t, const std::vector<capture>&);
+    void store_captures(const std::string& input,
+        const std::vector<capture>&, matched_patterns_t&) const;
+public:
+    // max_bytes limits the memory used by the entries
+    explicit abnf_cache(const abnf_parser&, size_t max_bytes = 16 << 20);
+
+    // matches the same way as abnf_machine::run; results other than
+    // MATCHED and NOT_MATCHED aren't cached
+    abnf_machine::result_t run(const std::string& input, matched_patterns_t&);
+
+    stats_t get_stats();
+    void clear();
+
+    // 64 bit hash of the bytes
+    static uint64_t hash(const char* bytes, size_t size);
+};
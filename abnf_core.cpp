@@ -0,0 +1,115 @@
+#include "abnf_parser.h"
+#include <cassert>
+
+// core rules of rfc 5234 appendix b
+
+namespace
+{
+
+std::bitset<256> make_class(int first, int last)
+{
+    std::bitset<256> bytes;
+    for(int i = first; i <= last; i++)
+        bytes.set(i);
+    return bytes;
+}
+
+abnf_repetition make_class_element(abnf_parser& parser, const std::bitset<256>& bytes)
+{
+    boost::shared_ptr<abnf_element> element = parser.make_node<abnf_class>(parser, bytes);
+    return abnf_repetition(parser, abnf_element(parser, element, false));
+}
+
+abnf_repetition make_literal(abnf_parser& parser, const std::string& literal)
+{
+    boost::shared_ptr<abnf_element> element = parser.make_node<abnf_vals>(parser, literal, true);
+    return abnf_repetition(parser, abnf_element(parser, element, false));
+}
+
+}
+
+abnf_class::abnf_class(abnf_parser& parser, const std::bitset<256>& bytes) :
+    abnf_element(parser),
+    bytes(bytes)
+{
+}
+
+bool abnf_class::run(str_const_iterator& it, const str_const_iterator& end, matched_patterns_t&) const
+{
+    if(it == end || !this->bytes.test((unsigned char)*it))
+        return false;
+    it++;
+    return true;
+}
+
+abnf_rule* abnf_parser::get_core_rule(const std::string& rulename)
+{
+    for(auto it = this->core_rules.begin(); it != this->core_rules.end(); it++)
+        if(it->rulename == rulename)
+            return &(*it);
+
+    const std::bitset<256> wsp = make_class(0x20, 0x20) | make_class(0x09, 0x09);
+    abnf_alternation alternation(*this);
+
+    if(rulename == "ALPHA")
+        alternation = abnf_alternation(*this, abnf_concatenation(*this,
+            make_class_element(*this, make_class(0x41, 0x5a) | make_class(0x61, 0x7a))));
+    else if(rulename == "BIT")
+        alternation = abnf_alternation(*this, abnf_concatenation(*this,
+            make_class_element(*this, make_class('0', '1'))));
+    else if(rulename == "CHAR")
+        alternation = abnf_alternation(*this, abnf_concatenation(*this,
+            make_class_element(*this, make_class(0x01, 0x7f))));
+    else if(rulename == "CR")
+        alternation = abnf_alternation(*this, abnf_concatenation(*this, make_literal(*this, "\r")));
+    else if(rulename == "CRLF")
+        alternation = abnf_alternation(*this, abnf_concatenation(*this, make_literal(*this, "\r\n")));
+    else if(rulename == "CTL")
+        alternation = abnf_alternation(*this, abnf_concatenation(*this,
+            make_class_element(*this, make_class(0x00, 0x1f) | make_class(0x7f, 0x7f))));
+    else if(rulename == "DIGIT")
+        alternation = abnf_alternation(*this, abnf_concatenation(*this,
+            make_class_element(*this, make_class('0', '9'))));
+    else if(rulename == "DQUOTE")
+        alternation = abnf_alternation(*this, abnf_concatenation(*this, make_literal(*this, "\"")));
+    else if(rulename == "HEXDIG")
+    {
+        // the letters are case insensitive
+        alternation = abnf_alternation(*this, abnf_concatenation(*this, make_class_element(*this,
+            make_class('0', '9') | make_class('A', 'F') | make_class('a', 'f'))));
+    }
+    else if(rulename == "HTAB")
+        alternation = abnf_alternation(*this, abnf_concatenation(*this, make_literal(*this, "\t")));
+    else if(rulename == "LF")
+        alternation = abnf_alternation(*this, abnf_concatenation(*this, make_literal(*this, "\n")));
+    else if(rulename == "LWSP")
+    {
+        // *(WSP / CRLF WSP)
+        boost::shared_ptr<abnf_alternation> group = this->make_node<abnf_alternation>(*this,
+            abnf_concatenation(*this, make_class_element(*this, wsp)));
+        group->add(abnf_concatenation(*this, make_literal(*this, "\r\n"), make_class_element(*this, wsp)));
+        alternation = abnf_alternation(*this, abnf_concatenation(*this,
+            abnf_repetition(*this, abnf_element(*this, group, false), -1, -1)));
+    }
+    else if(rulename == "OCTET")
+        alternation = abnf_alternation(*this, abnf_concatenation(*this,
+            make_class_element(*this, make_class(0x00, 0xff))));
+    else if(rulename == "SP")
+        alternation = abnf_alternation(*this, abnf_concatenation(*this, make_literal(*this, " ")));
+    else if(rulename == "VCHAR")
+        alternation = abnf_alternation(*this, abnf_concatenation(*this,
+            make_class_element(*this, make_class(0x21, 0x7e))));
+    else if(rulename == "WSP")
+        alternation = abnf_alternation(*this, abnf_concatenation(*this, make_class_element(*this, wsp)));
+    else
+        return NULL;
+
+    this->core_rules.push_back(abnf_rule(*this, rulename, alternation, false));
+
+    std::vector<abnf_diagnostic> diagnostics;
+    bool analyzed = this->core_rules.back().analyze(diagnostics);
+    assert(analyzed && diagnostics.empty());
+    (void)analyzed;
+
+    return &this->core_rules.back();
+}
@@ -0,0 +1,703 @@
+#include "abnf_dfa.h"
+#include "abnf_machine.h"
+#include <algorithm>
+#include <cassert>
+#include <map>
+
+// the automaton is built by running the compiled rule on every possible byte
+// with all the alternatives of a choice running in parallel, in the order the
+// machine would try them. the alternative of a choice is dropped when the
+// choice commits, and a match becomes the result once every thread that would
+// be tried before it has died. a thread that commits while it still waits on
+// other choices only drops the alternative once those choices have failed
+
+namespace
+{
+
+struct dfa_frame
+{
+    enum kind_t {CALL, COUNTER, MARK};
+    kind_t kind;
+    // call: return address, counter: repetition count, mark: choice id
+    int value;
+
+    bool operator==(const dfa_frame& other) const
+    {
+        return this->kind == other.kind && this->value == other.value;
+    }
+    bool operator<(const dfa_frame& other) const
+    {
+        return this->kind != other.kind ? this->kind < other.kind : this->value < other.value;
+    }
+};
+
+struct dfa_thread
+{
+    int pc, offset;
+    // the rule returned
+    bool accept;
+    // number of bytes read after the rule returned; the automaton can only
+    // end the match at the current byte or right before it
+    int carried;
+    std::vector<dfa_frame> frames;
+    // ids of the choices that must fail before this thread is the result
+    std::vector<int> waits;
+    // the thread dies when all the choices of a condition have failed;
+    // a condition is dropped when one of its choices commits
+    std::vector<std::vector<int> > conditions;
+
+    bool operator==(const dfa_thread& other) const
+    {
+        return this->pc == other.pc && this->offset == other.offset &&
+            this->accept == other.accept && this->carried == other.carried &&
+            this->frames == other.frames && this->waits == other.waits &&
+            this->conditions == other.conditions;
+    }
+    // the thread runs the same way as the other thread, and dies whenever
+    // the other thread is dropped by a choice
+    bool covers(const dfa_thread& other) const
+    {
+        if(this->pc != other.pc || this->offset != other.offset ||
+            this->accept != other.accept || this->carried != other.carried ||
+            this->frames != other.frames)
+            return false;
+        for(auto it = this->waits.begin(); it != this->waits.end(); it++)
+            if(std::find(other.waits.begin(), other.waits.end(), *it) == other.waits.end())
+                return false;
+        for(auto it = this->conditions.begin(); it != this->conditions.end(); it++)
+            if(std::find(other.conditions.begin(), other.conditions.end(), *it) == other.conditions.end())
+                return false;
+        return true;
+    }
+    bool operator<(const dfa_thread& other) const
+    {
+        if(this->pc != other.pc)
+            return this->pc < other.pc;
+        if(this->offset != other.offset)
+            return this->offset < other.offset;
+        if(this->accept != other.accept)
+            return this->accept < other.accept;
+        if(this->carried != other.carried)
+            return this->carried < other.carried;
+        if(this->frames != other.frames)
+            return this->frames < other.frames;
+        if(this->waits != other.waits)
+            return this->waits < other.waits;
+        return this->conditions < other.conditions;
+    }
+};
+
+// threads in the order the machine would try them
+typedef std::vector<dfa_thread> dfa_state;
+
+bool char_matches(char pattern, char c, bool sensitive)
+{
+    return sensitive ? (pattern == c) : (pattern == fold_case(c));
+}
+
+class dfa_builder
+{
+private:
+    static const size_t max_threads = 64;
+
+    const abnf_program& program;
+    int rule;
+    int next_id;
+    std::vector<int> killed;
+    // choices committed by threads that still wait on the choices of the condition
+    std::vector<std::pair<int, std::vector<int> > > deferred;
+    dfa_state out;
+
+    // choices the thread waits on that still have a running first alternative
+    std::vector<int> get_pending(const dfa_thread&) const;
+    // drops the alternative of the choice committed by the thread
+    void kill(int id, const dfa_thread& killer);
+    bool is_killed(const dfa_thread&) const;
+    // drops the conditions that contain a committed choice
+    void drop_conditions(dfa_thread&) const;
+    void add(const dfa_thread&);
+    // follows the instructions that don't consume input;
+    // path holds the loops entered without consuming input
+    void closure(dfa_thread, std::vector<int>& path);
+    // returns a negative transition if the step ends the match
+    int finish();
+public:
+    bool failed;
+
+    dfa_builder(const abnf_program& program, int rule) :
+        program(program), rule(rule), next_id(0), failed(false) {}
+
+    int start(dfa_state& next);
+    // byte is negative at the end of the input
+    int step(const dfa_state&, int byte, dfa_state& next);
+};
+
+std::vector<int> dfa_builder::get_pending(const dfa_thread& thread) const
+{
+    // the first alternatives of the choices are run before the thread
+    std::vector<int> pending;
+    for(auto it = thread.waits.begin(); it != thread.waits.end(); it++)
+        for(auto jt = this->out.begin(); jt != this->out.end(); jt++)
+        {
+            dfa_frame mark = {dfa_frame::MARK, *it};
+            if(std::find(jt->frames.begin(), jt->frames.end(), mark) != jt->frames.end())
+            {
+                pending.push_back(*it);
+                break;
+            }
+        }
+    return pending;
+}
+
+void dfa_builder::kill(int id, const dfa_thread& killer)
+{
+    std::vector<int> pending = this->get_pending(killer);
+    if(!pending.empty())
+    {
+        this->deferred.push_back(std::make_pair(id, pending));
+        for(auto it = this->out.begin(); it != this->out.end(); it++)
+            if(std::find(it->waits.begin(), it->waits.end(), id) != it->waits.end())
+                it->conditions.push_back(pending);
+        return;
+    }
+
+    this->killed.push_back(id);
+
+    dfa_state::iterator it = this->out.begin();
+    while(it != this->out.end())
+    {
+        if(std::find(it->waits.begin(), it->waits.end(), id) != it->waits.end())
+            it = this->out.erase(it);
+        else
+        {
+            this->drop_conditions(*it);
+            it++;
+        }
+    }
+}
+
+void dfa_builder::drop_conditions(dfa_thread& thread) const
+{
+    auto it = thread.conditions.begin();
+    while(it != thread.conditions.end())
+    {
+        bool committed = false;
+        for(auto jt = it->begin(); jt != it->end() && !committed; jt++)
+            committed = std::find(this->killed.begin(), this->killed.end(), *jt) != this->killed.end();
+        if(committed)
+            it = thread.conditions.erase(it);
+        else
+            it++;
+    }
+}
+
+bool dfa_builder::is_killed(const dfa_thread& thread) const
+{
+    for(auto it = thread.waits.begin(); it != thread.waits.end(); it++)
+        if(std::find(this->killed.begin(), this->killed.end(), *it) != this->killed.end())
+            return true;
+    return false;
+}
+
+void dfa_builder::add(const dfa_thread& added)
+{
+    dfa_thread thread = added;
+    for(auto it = this->deferred.begin(); it != this->deferred.end(); it++)
+        if(std::find(thread.waits.begin(), thread.waits.end(), it->first) != thread.waits.end())
+            thread.conditions.push_back(it->second);
+    this->drop_conditions(thread);
+
+    // a thread that is tried later and only runs when an identical
+    // thread has died can't change the result
+    for(auto it = this->out.begin(); it != this->out.end(); it++)
+        if(it->covers(thread))
+            return;
+
+    // ambiguous alternatives that are still undecided after every byte
+    // multiply the threads
+    if(this->out.size() >= max_threads)
+    {
+        this->failed = true;
+        return;
+    }
+    this->out.push_back(thread);
+}
+
+void dfa_builder::closure(dfa_thread thread, std::vector<int>& path)
+{
+    for(;;)
+    {
+        if(this->failed || this->is_killed(thread))
+            return;
+
+        const abnf_program::instruction& ins = this->program.code[thread.pc];
+        switch(ins.op)
+        {
+        case abnf_program::OP_CHAR_VAL:
+            if(thread.offset == (int)this->program.literals[ins.a].size())
+            {
+                thread.pc++;
+                thread.offset = 0;
+                break;
+            }
+            this->add(thread);
+            return;
+        case abnf_program::OP_CLASS:
+            this->add(thread);
+            return;
+        case abnf_program::OP_CHOICE:
+            {
+                dfa_thread alternative = thread;
+                int id = this->next_id++;
+                alternative.pc = ins.a;
+                alternative.waits.push_back(id);
+
+                dfa_frame mark = {dfa_frame::MARK, id};
+                thread.frames.push_back(mark);
+                thread.pc++;
+
+                path.push_back(thread.pc - 1);
+                this->closure(thread, path);
+                path.pop_back();
+                this->closure(alternative, path);
+            }
+            return;
+        case abnf_program::OP_COMMIT:
+            assert(thread.frames.back().kind == dfa_frame::MARK);
+            this->kill(thread.frames.back().value, thread);
+            thread.frames.pop_back();
+            thread.pc = ins.a;
+            break;
+        case abnf_program::OP_CALL:
+            {
+                // inner captures can't be stored by the automaton
+                if(this->program.rules[ins.a].store_matched || thread.frames.size() > 256)
+                {
+                    this->failed = true;
+                    return;
+                }
+                dfa_frame call = {dfa_frame::CALL, thread.pc + 1};
+                thread.frames.push_back(call);
+                thread.pc = this->program.rules[ins.a].address;
+            }
+            break;
+        case abnf_program::OP_RETURN:
+            if(thread.frames.empty())
+            {
+                thread.pc = -1;
+                thread.accept = true;
+                this->add(thread);
+                return;
+            }
+            assert(thread.frames.back().kind == dfa_frame::CALL);
+            thread.pc = thread.frames.back().value;
+            thread.frames.pop_back();
+            break;
+        case abnf_program::OP_REP_BEGIN:
+            {
+                dfa_frame counter = {dfa_frame::COUNTER, 0};
+                thread.frames.push_back(counter);
+                thread.pc++;
+            }
+            break;
+        case abnf_program::OP_REP_NEXT:
+            {
+                // an iteration that didn't consume input would repeat forever
+                if(std::find(path.begin(), path.end(), ins.a) != path.end())
+                {
+                    this->failed = true;
+                    return;
+                }
+
+                assert(thread.frames.back().kind == dfa_frame::MARK);
+                this->kill(thread.frames.back().value, thread);
+                thread.frames.pop_back();
+
+                // counts past the minimum of an unbounded repetition behave the same
+                int exit = this->program.code[ins.a].a;
+                const abnf_program::instruction& bounds = this->program.code[exit];
+                assert(bounds.op == abnf_program::OP_REP_END);
+                int limit = bounds.b != -1 ? bounds.b : std::max(bounds.a, 0);
+                assert(thread.frames.back().kind == dfa_frame::COUNTER);
+                int& count = thread.frames.back().value;
+                count = std::min(count + 1, limit);
+                thread.pc = (count == ins.b) ? exit : ins.a;
+            }
+            break;
+        case abnf_program::OP_REP_END:
+            {
+                assert(thread.frames.back().kind == dfa_frame::COUNTER);
+                int count = thread.frames.back().value;
+                thread.frames.pop_back();
+                if(count < ins.a)
+                    return;
+                thread.pc++;
+            }
+            break;
+        default:
+            this->failed = true;
+            return;
+        }
+    }
+}
+
+int dfa_builder::finish()
+{
+    // waits on choices whose first alternative has died are satisfied, and the
+    // threads with a condition whose choices have all failed die. the threads
+    // that die can satisfy more waits and conditions
+    for(bool died = true; died;)
+    {
+        std::vector<int> marks;
+        for(auto it = this->out.begin(); it != this->out.end(); it++)
+            for(auto jt = it->frames.begin(); jt != it->frames.end(); jt++)
+                if(jt->kind == dfa_frame::MARK)
+                    marks.push_back(jt->value);
+
+        died = false;
+        dfa_state::iterator it = this->out.begin();
+        while(it != this->out.end())
+        {
+            std::vector<int> waits;
+            for(auto jt = it->waits.begin(); jt != it->waits.end(); jt++)
+                if(std::find(marks.begin(), marks.end(), *jt) != marks.end())
+                    waits.push_back(*jt);
+            it->waits.swap(waits);
+
+            bool failed = false;
+            for(auto jt = it->conditions.begin(); jt != it->conditions.end(); jt++)
+            {
+                std::vector<int> condition;
+                for(auto kt = jt->begin(); kt != jt->end(); kt++)
+                    if(std::find(marks.begin(), marks.end(), *kt) != marks.end())
+                        condition.push_back(*kt);
+                jt->swap(condition);
+                failed = failed || jt->empty();
+            }
+
+            if(failed)
+            {
+                it = this->out.erase(it);
+                died = true;
+            }
+            else
+                it++;
+        }
+    }
+
+    if(this->out.empty())
+        return abnf_dfa::DEAD;
+
+    // a match that is still undecided after two bytes would need
+    // to be remembered by the automaton
+    for(auto it = this->out.begin(); it != this->out.end(); it++)
+    {
+        if(it->carried > 1)
+            this->failed = true;
+        if(it == this->out.begin() && it->accept && it->conditions.empty())
+            break;
+    }
+
+    if(this->out.front().accept && this->out.front().conditions.empty())
+    {
+        assert(this->out.front().waits.empty());
+        return this->out.front().carried ? abnf_dfa::ACCEPT_BEFORE : abnf_dfa::ACCEPT_AFTER;
+    }
+
+    // number the choices in the order they appear so that equal states compare equal
+    std::map<int, int> ids;
+    for(auto it = this->out.begin(); it != this->out.end(); it++)
+        for(auto jt = it->frames.begin(); jt != it->frames.end(); jt++)
+            if(jt->kind == dfa_frame::MARK)
+            {
+                if(ids.find(jt->value) == ids.end())
+                {
+                    int id = (int)ids.size();
+                    ids[jt->value] = id;
+                }
+                jt->value = ids[jt->value];
+            }
+    for(auto it = this->out.begin(); it != this->out.end(); it++)
+    {
+        for(auto jt = it->waits.begin(); jt != it->waits.end(); jt++)
+            *jt = ids[*jt];
+        std::sort(it->waits.begin(), it->waits.end());
+        for(auto jt = it->conditions.begin(); jt != it->conditions.end(); jt++)
+        {
+            for(auto kt = jt->begin(); kt != jt->end(); kt++)
+                *kt = ids[*kt];
+            std::sort(jt->begin(), jt->end());
+        }
+        std::sort(it->conditions.begin(), it->conditions.end());
+        it->conditions.erase(std::unique(it->conditions.begin(), it->conditions.end()),
+            it->conditions.end());
+    }
+
+    // the satisfied waits and conditions can leave threads that only run
+    // when an earlier identical thread has died
+    dfa_state kept;
+    for(auto it = this->out.begin(); it != this->out.end(); it++)
+    {
+        bool covered = false;
+        for(auto jt = kept.begin(); jt != kept.end() && !covered; jt++)
+            covered = jt->covers(*it);
+        if(!covered)
+            kept.push_back(*it);
+    }
+    this->out.swap(kept);
+
+    return 0;
+}
+
+int dfa_builder::start(dfa_state& next)
+{
+    this->out.clear();
+    this->killed.clear();
+    this->deferred.clear();
+    this->next_id = 0;
+
+    dfa_thread thread;
+    thread.pc = this->program.rules[this->rule].address;
+    thread.offset = 0;
+    thread.accept = false;
+    thread.carried = 0;
+
+    std::vector<int> path;
+    this->closure(thread, path);
+
+    int result = this->finish();
+    // a match at the start is made without reading input
+    if(result == abnf_dfa::ACCEPT_AFTER)
+        result = abnf_dfa::ACCEPT_BEFORE;
+    next.swap(this->out);
+    return result;
+}
+
+int dfa_builder::step(const dfa_state& state, int byte, dfa_state& next)
+{
+    this->out.clear();
+    this->killed.clear();
+    this->deferred.clear();
+    this->next_id = 0;
+    for(auto it = state.begin(); it != state.end(); it++)
+        for(auto jt = it->frames.begin(); jt != it->frames.end(); jt++)
+            if(jt->kind == dfa_frame::MARK)
+                this->next_id = std::max(this->next_id, jt->value + 1);
+
+    for(auto it = state.begin(); it != state.end(); it++)
+    {
+        if(this->is_killed(*it))
+            continue;
+
+        if(it->accept)
+        {
+            dfa_thread thread = *it;
+            thread.carried++;
+            this->add(thread);
+            continue;
+        }
+        if(byte < 0)
+            continue;
+
+        const abnf_program::instruction& ins = this->program.code[it->pc];
+        dfa_thread thread = *it;
+        if(ins.op == abnf_program::OP_CHAR_VAL)
+        {
+            const std::string& literal = this->program.literals[ins.a];
+            if(!char_matches(literal[thread.offset], (char)byte, ins.sensitive))
+                continue;
+            thread.offset++;
+        }
+        else
+        {
+            assert(ins.op == abnf_program::OP_CLASS);
+            if(!this->program.classes[ins.a].test(byte))
+                continue;
+            thread.pc++;
+        }
+
+        std::vector<int> path;
+        this->closure(thread, path);
+    }
+
+    int result = this->finish();
+    next.swap(this->out);
+    return result;
+}
+
+}
+
+abnf_dfa::abnf_dfa(abnf_allocator& allocator) :
+    table(abnf_std_allocator<int>(allocator)),
+    eof(abnf_std_allocator<int>(allocator)),
+    start(DEAD)
+{
+}
+
+bool abnf_dfa::build(const abnf_program& program, int rule, size_t max_states)
+{
+    dfa_builder builder(program, rule);
+    std::map<dfa_state, int> indices;
+    std::vector<dfa_state> states(1);
+
+    this->table.clear();
+    this->eof.clear();
+
+    this->start = builder.start(states[0]);
+    if(builder.failed)
+        return false;
+    if(this->start == DEAD || this->start == ACCEPT_BEFORE)
+        return true;
+    this->start = 0;
+    indices[states[0]] = 0;
+
+    for(size_t i = 0; i < states.size(); i++)
+    {
+        dfa_state next;
+        for(int byte = 0; byte < 256; byte++)
+        {
+            int transition = builder.step(states[i], byte, next);
+            if(builder.failed)
+                return false;
+
+            if(transition == 0)
+            {
+                auto it = indices.find(next);
+                if(it != indices.end())
+                    transition = it->second;
+                else
+                {
+                    if(states.size() >= max_states)
+                        return false;
+                    transition = (int)states.size();
+                    indices[next] = transition;
+                    states.push_back(next);
+                }
+            }
+            this->table.push_back(transition);
+        }
+
+        int transition = builder.step(states[i], -1, next);
+        if(builder.failed)
+            return false;
+        assert(transition < 0);
+        this->eof.push_back(transition);
+    }
+
+    this->minimize();
+    return true;
+}
+
+void abnf_dfa::minimize()
+{
+    // states are split by their transitions until the partition doesn't change
+    const size_t count = this->eof.size();
+    std::vector<int> block(this->eof.begin(), this->eof.end());
+    size_t blocks = 0;
+
+    for(;;)
+    {
+        std::map<std::vector<int>, int> signatures;
+        std::vector<int> next(count);
+        for(size_t i = 0; i < count; i++)
+        {
+            std::vector<int> signature(1, block[i]);
+            for(size_t j = 0; j < 256; j++)
+            {
+                int transition = this->table[i * 256 + j];
+                signature.push_back(transition < 0 ? transition : block[transition] + 3);
+            }
+
+            auto it = signatures.find(signature);
+            if(it == signatures.end())
+                it = signatures.insert(std::make_pair(signature, (int)signatures.size())).first;
+            next[i] = it->second;
+        }
+
+        block.swap(next);
+        if(signatures.size() == blocks)
+            break;
+        blocks = signatures.size();
+    }
+
+    transitions_t table(blocks * 256, 0, this->table.get_allocator());
+    transitions_t eof(blocks, 0, this->eof.get_allocator());
+    for(size_t i = 0; i < count; i++)
+    {
+        for(size_t j = 0; j < 256; j++)
+        {
+            int transition = this->table[i * 256 + j];
+            table[block[i] * 256 + j] = transition < 0 ? transition : block[transition];
+        }
+        eof[block[i]] = this->eof[i];
+    }
+
+    this->table.swap(table);
+    this->eof.swap(eof);
+    this->start = block[this->start];
+}
+
+size_t abnf_parser::compile_dfa(size_t max_states)
+{
+    // the automatons are built from the elements
+    this->entry.set_dfa(boost::shared_ptr<const abnf_dfa>());
+    for(auto it = this->rules.begin(); it != this->rules.end(); it++)
+        it->set_dfa(boost::shared_ptr<const abnf_dfa>());
+
+    abnf_program program(*this);
+    size_t compiled = 0;
+
+    for(size_t i = 0; i < program.rules.size(); i++)
+    {
+        // core rules are already single byte classes or short sequences of them
+        abnf_rule* rule = NULL;
+        if(program.rules[i].rule == &this->entry)
+            rule = &this->entry;
+        for(auto it = this->rules.begin(); it != this->rules.end() && !rule; it++)
+            if(program.rules[i].rule == &(*it))
+                rule = &(*it);
+        if(!rule)
+            continue;
+
+        boost::shared_ptr<abnf_dfa> dfa = boost::allocate_shared<abnf_dfa>(
+            abnf_std_allocator<abnf_dfa>(*this->allocator), *this->allocator);
+        if(!dfa->build(program, (int)i, max_states))
+            continue;
+
+        rule->set_dfa(dfa);
+        compiled++;
+    }
+
+    return compiled;
+}
+
+bool abnf_dfa::run(str_const_iterator& it, const str_const_iterator& end) const
+{
+    str_const_iterator last;
+    return this->run(it, end, last);
+}
+
+bool abnf_dfa::run(str_const_iterator& it, const str_const_iterator& end, str_const_iterator& last) const
+{
+    last = it;
+    if(this->start < 0)
+        return this->start == ACCEPT_BEFORE;
+
+    const int* table = &this->table[0];
+    int state = this->start;
+    for(str_const_iterator jt = it;; jt++)
+    {
+        int transition = (jt == end) ? this->eof[state] : table[state * 256 + (unsigned char)*jt];
+        if(transition >= 0)
+        {
+            state = transition;
+            continue;
+        }
+
+        last = jt;
+        if(transition == DEAD)
+            return false;
+        it = (transition == ACCEPT_BEFORE) ? jt : jt + 1;
+        return true;
+    }
+}
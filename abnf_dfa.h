@@ -0,0 +1,45 @@
+#pragma once
+
+#include "abnf_parser.h"
+
+class abnf_program;
+
+// deterministic automaton of a rule that doesn't need backtracking state.
+// the automaton reads the input one byte at a time and decides whether the
+// rule matched, and where it ended, without going back in the input
+class abnf_dfa
+{
+public:
+    // negative transitions
+    enum {DEAD = -1, ACCEPT_BEFORE = -2 /*matched before the byte*/, ACCEPT_AFTER = -3};
+private:
+    typedef std::vector<int, abnf_std_allocator<int> > transitions_t;
+
+    // 256 transitions per state
+    transitions_t table;
+    // the transition taken at the end of the input for each state
+    transitions_t eof;
+    // state index or a negative transition
+    int start;
+
+    void minimize();
+public:
+    // the tables are allocated with the allocator
+    explicit abnf_dfa(abnf_allocator& = abnf_allocator::get_default());
+
+    // builds the automaton of a compiled rule; returns false if the rule calls
+    // other captured rules, its match result depends on more than one byte
+    // of lookahead, its alternatives stay ambiguous for too long or the
+    // automaton would have more than max_states states
+    bool build(const abnf_program&, int rule, size_t max_states);
+    // matches the same way as abnf_rule::run
+    bool run(str_const_iterator& it, const str_const_iterator& end) const;
+    // also stores the position of the last byte read, or end if the automaton
+    // read the end of the input
+    bool run(str_const_iterator& it, const str_const_iterator& end, str_const_iterator& last) const;
+
+    size_t count_states() const {return this->eof.size();}
+    // bytes held by the transition tables
+    size_t get_memory() const
+    {return (this->table.capacity() + this->eof.capacity()) * sizeof(int);}
+};
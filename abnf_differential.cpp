@@ -0,0 +1,415 @@
+#include "abnf_differential.h"
+#include <cassert>
+#include <chrono>
+#include <istream>
+#include <ostream>
+#include <iomanip>
+#include <sstream>
+
+namespace
+{
+
+const char* engine_names[] = {"tree walker", "optimized", "dfa", "machine", "memo", "cache"};
+
+typedef std::chrono::steady_clock clock_type;
+
+double seconds_since(const clock_type::time_point& start)
+{
+    return std::chrono::duration<double>(clock_type::now() - start).count();
+}
+
+size_t pick(std::mt19937& rng, size_t n)
+{
+    return std::uniform_int_distribution<size_t>(0, n - 1)(rng);
+}
+
+std::string random_alternation(std::mt19937& rng, size_t rules, int depth);
+
+std::string random_element(std::mt19937& rng, size_t rules, int depth)
+{
+    static const char* literals[] = {"a", "b", "ab", "ba", "0", "01", "-", ""};
+    static const char* numerals[] = {"%x61", "%x61-63", "%x30-39", "%x61.62", "%d97"};
+    static const char* core[] = {"ALPHA", "DIGIT", "SP", "HEXDIG"};
+
+    switch(pick(rng, depth < 2 ? 6 : 4))
+    {
+    case 0:
+        if(rules)
+            return "r" + std::to_string(pick(rng, rules));
+        // fall through
+    case 1:
+        return std::string("\"") + literals[pick(rng, sizeof(literals) / sizeof(*literals))] + "\"";
+    case 2:
+        return numerals[pick(rng, sizeof(numerals) / sizeof(*numerals))];
+    case 3:
+        return core[pick(rng, sizeof(core) / sizeof(*core))];
+    case 4:
+        return "(" + random_alternation(rng, rules, depth + 1) + ")";
+    default:
+        return "[" + random_alternation(rng, rules, depth + 1) + "]";
+    }
+}
+
+std::string random_repetition(std::mt19937& rng, size_t rules, int depth)
+{
+    static const char* repeats[] = {"", "", "", "*", "1*", "2", "0*2", "1*3", "*2"};
+    return repeats[pick(rng, sizeof(repeats) / sizeof(*repeats))] + random_element(rng, rules, depth);
+}
+
+std::string random_alternation(std::mt19937& rng, size_t rules, int depth)
+{
+    std::string alternation;
+    for(size_t i = 0, n = 1 + pick(rng, 3); i < n; i++)
+    {
+        if(i)
+            alternation += " / ";
+        for(size_t j = 0, m = 1 + pick(rng, 3); j < m; j++)
+        {
+            if(j)
+                alternation += " ";
+            alternation += random_repetition(rng, rules, depth);
+        }
+    }
+    return alternation;
+}
+
+}
+
+abnf_differential::abnf_differential() :
+    slow_factor(10),
+    min_seconds(0.001),
+    max_seconds(0.1)
+{
+}
+
+bool abnf_differential::build(abnf_parser& parser) const
+{
+    assert(this->grammar.rules.size() == this->grammar.store_matched.size());
+    for(size_t i = 0; i < this->grammar.rules.size(); i++)
+        if(!parser.add_rule(this->grammar.rules[i], this->grammar.store_matched[i]))
+            return false;
+    return parser.generate(this->grammar.entry);
+}
+
+bool abnf_differential::load(const grammar_t& grammar)
+{
+    this->grammar = grammar;
+    this->machine.reset();
+    this->cache.reset();
+
+    this->reference.reset(new abnf_parser);
+    this->optimized.reset(new abnf_parser);
+    this->dfa.reset(new abnf_parser);
+    if(!this->build(*this->reference) || !this->build(*this->optimized) || !this->build(*this->dfa))
+        return false;
+
+    this->optimized->optimize();
+    this->dfa->compile_dfa();
+    this->machine.reset(new abnf_machine(*this->reference));
+    this->cache.reset(new abnf_cache(*this->reference));
+    return true;
+}
+
+void abnf_differential::keep(const std::string& input, const std::string& reason)
+{
+    case_t c;
+    c.grammar = this->grammar;
+    c.input = input;
+    c.reason = reason;
+    this->corpus.push_back(c);
+}
+
+abnf_differential::report_t abnf_differential::run(const std::string& input)
+{
+    assert(this->machine);
+
+    report_t report;
+    report.agreed = true;
+    report.engine = ENGINE_COUNT;
+
+    // the reference
+    matched_patterns_t expected;
+    str_const_iterator it = input.begin();
+    clock_type::time_point start = clock_type::now();
+    bool expected_matched = this->reference->run(it, input.end(), expected);
+    report.seconds[TREE_WALKER] = seconds_since(start);
+    const str_const_iterator expected_end = it;
+
+    bool matched[ENGINE_COUNT];
+    matched_patterns_t out[ENGINE_COUNT];
+    str_const_iterator end[ENGINE_COUNT];
+
+    // tree walkers of the modified parsers
+    abnf_parser* parsers[] = {this->optimized.get(), this->dfa.get()};
+    engine_t engines[] = {OPTIMIZED, DFA};
+    for(size_t i = 0; i < 2; i++)
+    {
+        end[engines[i]] = input.begin();
+        start = clock_type::now();
+        matched[engines[i]] = parsers[i]->run(end[engines[i]], input.end(), out[engines[i]]);
+        report.seconds[engines[i]] = seconds_since(start);
+    }
+
+    end[MACHINE] = input.begin();
+    start = clock_type::now();
+    abnf_machine::result_t result = this->machine->run(end[MACHINE], input.end(), out[MACHINE]);
+    report.seconds[MACHINE] = seconds_since(start);
+    matched[MACHINE] = (result == abnf_machine::MATCHED);
+    if(result != abnf_machine::MATCHED && result != abnf_machine::NOT_MATCHED)
+        this->keep(input, "machine exceeded its depth or budget");
+
+    // the document is parsed before an edit that turns it into the input,
+    // so the second parse reuses the results of the first
+    abnf_document document(*this->reference, input + "#");
+    document.parse(out[MEMO]);
+    document.edit(input.size(), 1, "");
+    out[MEMO].clear();
+    start = clock_type::now();
+    matched[MEMO] = (document.parse(out[MEMO]) == abnf_machine::MATCHED);
+    report.seconds[MEMO] = seconds_since(start);
+
+    // the second run is a hit
+    matched_patterns_t miss;
+    abnf_machine::result_t miss_result = this->cache->run(input, miss);
+    start = clock_type::now();
+    abnf_machine::result_t hit_result = this->cache->run(input, out[CACHE]);
+    report.seconds[CACHE] = seconds_since(start);
+    matched[CACHE] = (hit_result == abnf_machine::MATCHED);
+
+    for(int i = OPTIMIZED; i < ENGINE_COUNT; i++)
+    {
+        // the document and the cache don't report where the match ended
+        bool has_end = (i == OPTIMIZED || i == DFA || i == MACHINE);
+        if(matched[i] == expected_matched && out[i] == expected && (!has_end || end[i] == expected_end))
+            continue;
+
+        if(report.agreed)
+        {
+            report.agreed = false;
+            report.engine = (engine_t)i;
+        }
+        this->keep(input, std::string("mismatch: ") + engine_names[i]);
+    }
+
+    if(miss_result != hit_result || miss != out[CACHE])
+    {
+        if(report.agreed)
+        {
+            report.agreed = false;
+            report.engine = CACHE;
+        }
+        this->keep(input, "cache hit/miss disagree");
+    }
+
+    for(int i = TREE_WALKER; i < ENGINE_COUNT; i++)
+    {
+        if(report.seconds[i] > this->max_seconds)
+            this->keep(input, std::string("pathological: ") + engine_names[i]);
+        else if(i != TREE_WALKER && report.seconds[i] > this->min_seconds &&
+            report.seconds[i] > this->slow_factor * report.seconds[TREE_WALKER])
+            this->keep(input, std::string("slow: ") + engine_names[i]);
+    }
+
+    return report;
+}
+
+const char* abnf_differential::get_engine_name(engine_t engine)
+{
+    assert(engine < ENGINE_COUNT);
+    return engine_names[engine];
+}
+
+void abnf_differential::write_corpus(std::ostream& os) const
+{
+    for(auto it = this->corpus.begin(); it != this->corpus.end(); it++)
+    {
+        os << "; " << it->reason << "\n; input: %x";
+        for(size_t i = 0; i < it->input.size(); i++)
+        {
+            if(i)
+                os << ".";
+            os << std::uppercase << std::hex << std::setw(2) << std::setfill('0')
+                << (int)(unsigned char)it->input[i] << std::dec << std::setfill(' ');
+        }
+        os << "\n";
+
+        for(size_t i = 0; i < it->grammar.rules.size(); i++)
+            os << it->grammar.rules[i] << (it->grammar.store_matched[i] ? "" : " ; not captured") << "\n";
+        os << "entry = " << it->grammar.entry << "\n\n";
+    }
+}
+
+std::vector<abnf_differential::case_t> abnf_differential::read_corpus(std::istream& is)
+{
+    static const std::string input_prefix = "; input: %x", not_captured = " ; not captured";
+
+    std::vector<case_t> corpus;
+    case_t c;
+    std::string line;
+    while(std::getline(is, line))
+    {
+        if(!line.empty() && line[line.size() - 1] == '\r')
+            line.erase(line.size() - 1);
+
+        if(line.compare(0, input_prefix.size(), input_prefix) == 0)
+        {
+            std::istringstream bytes(line.substr(input_prefix.size()));
+            unsigned int byte;
+            char dot;
+            while(bytes >> std::hex >> byte)
+            {
+                c.input += (char)byte;
+                bytes >> dot;
+            }
+        }
+        else if(line.compare(0, 2, "; ") == 0)
+            c.reason = line.substr(2);
+        else if(line.compare(0, 8, "entry = ") == 0)
+        {
+            // the entry object ends the case
+            c.grammar.entry = line.substr(8);
+            corpus.push_back(c);
+            c = case_t();
+        }
+        else if(!line.empty())
+        {
+            bool store_matched = true;
+            if(line.size() > not_captured.size() &&
+                line.compare(line.size() - not_captured.size(), not_captured.size(), not_captured) == 0)
+            {
+                line.erase(line.size() - not_captured.size());
+                store_matched = false;
+            }
+            c.grammar.rules.push_back(line);
+            c.grammar.store_matched.push_back(store_matched);
+        }
+    }
+
+    return corpus;
+}
+
+abnf_differential::grammar_t abnf_differential::random_grammar(std::mt19937& rng)
+{
+    grammar_t grammar;
+    for(size_t i = 0, n = pick(rng, 5); i < n; i++)
+    {
+        grammar.rules.push_back("r" + std::to_string(i) + " = " + random_alternation(rng, i, 0));
+        grammar.store_matched.push_back(pick(rng, 2) == 0);
+    }
+    grammar.entry = random_alternation(rng, grammar.rules.size(), 0);
+    return grammar;
+}
+
+abnf_differential::grammar_t abnf_differential::mutate_grammar(std::mt19937& rng, const grammar_t& grammar)
+{
+    static const char replacements[] = " /*[]()\"0123%x-.";
+
+    grammar_t mutated = grammar;
+    size_t index = pick(rng, mutated.rules.size() + 1);
+    std::string& syntax = (index < mutated.rules.size()) ? mutated.rules[index] : mutated.entry;
+
+    // the rulename and the defined-as of the rules aren't mutated
+    size_t begin = (index < mutated.rules.size()) ? syntax.find('=') + 1 : 0;
+    if(begin >= syntax.size())
+        return mutated;
+    size_t pos = begin + pick(rng, syntax.size() - begin);
+
+    switch(pick(rng, 4))
+    {
+    case 0:
+        syntax.erase(pos, 1);
+        break;
+    case 1:
+        syntax.insert(pos, 1, syntax[pos]);
+        break;
+    case 2:
+        syntax[pos] = replacements[pick(rng, sizeof(replacements) - 1)];
+        break;
+    default:
+        if(pos + 1 < syntax.size())
+            std::swap(syntax[pos], syntax[pos + 1]);
+        break;
+    }
+
+    if(index < mutated.rules.size() && pick(rng, 4) == 0)
+        mutated.store_matched[index] = !mutated.store_matched[index];
+    return mutated;
+}
+
+std::vector<abnf_differential::grammar_t> abnf_differential::seed_grammars()
+{
+    std::vector<grammar_t> seeds(4);
+
+    // rfc 3986
+    seeds[0].rules.push_back("scheme = ALPHA *(ALPHA / DIGIT / \"+\" / \"-\" / \".\")");
+    seeds[0].rules.push_back("unreserved = ALPHA / DIGIT / \"-\" / \".\" / \"_\" / \"~\"");
+    seeds[0].rules.push_back("pct-encoded = \"%\" HEXDIG HEXDIG");
+    seeds[0].rules.push_back("segment = *(unreserved / pct-encoded)");
+    seeds[0].rules.push_back("path = *(\"/\" segment)");
+    seeds[0].store_matched.assign(seeds[0].rules.size(), true);
+    seeds[0].store_matched[1] = false;
+    seeds[0].entry = "scheme \":\" path [\"?\" segment]";
+
+    // rfc 7230
+    seeds[1].rules.push_back("tchar = \"!\" / \"#\" / \"$\" / \"%\" / \"&\" / \"'\" / \"*\" / \"+\" / \"-\" / "
+        "\".\" / \"^\" / \"_\" / \"`\" / \"|\" / \"~\" / DIGIT / ALPHA");
+    seeds[1].rules.push_back("method = 1*tchar");
+    seeds[1].rules.push_back("request-target = 1*%x21-7E");
+    seeds[1].rules.push_back("HTTP-version = %x48.54.54.50 \"/\" DIGIT \".\" DIGIT");
+    seeds[1].store_matched.assign(seeds[1].rules.size(), true);
+    seeds[1].store_matched[0] = false;
+    seeds[1].entry = "method SP request-target SP HTTP-version CRLF";
+
+    // rfc 5234
+    seeds[2].rules.push_back("hex-val = \"x\" 1*HEXDIG [1*(\".\" 1*HEXDIG) / (\"-\" 1*HEXDIG)]");
+    seeds[2].rules.push_back("dec-val = \"d\" 1*DIGIT [1*(\".\" 1*DIGIT) / (\"-\" 1*DIGIT)]");
+    seeds[2].rules.push_back("num-val = \"%\" (hex-val / dec-val)");
+    seeds[2].rules.push_back("char-val = DQUOTE *(%x20-21 / %x23-7E) DQUOTE");
+    seeds[2].store_matched.assign(seeds[2].rules.size(), true);
+    seeds[2].entry = "1*((num-val / char-val) *WSP)";
+
+    // rfc 3339
+    seeds[3].rules.push_back("date-fullyear = 4DIGIT");
+    seeds[3].rules.push_back("date-month = 2DIGIT");
+    seeds[3].rules.push_back("date-mday = 2DIGIT");
+    seeds[3].rules.push_back("full-date = date-fullyear \"-\" date-month \"-\" date-mday");
+    seeds[3].rules.push_back("partial-time = 2DIGIT \":\" 2DIGIT \":\" 2DIGIT [\".\" 1*DIGIT]");
+    seeds[3].rules.push_back("time-offset = \"Z\" / (\"+\" / \"-\") 2DIGIT \":\" 2DIGIT");
+    seeds[3].store_matched.assign(seeds[3].rules.size(), true);
+    seeds[3].entry = "full-date [\"T\" partial-time time-offset]";
+
+    return seeds;
+}
+
+std::string abnf_differential::get_alphabet(const grammar_t& grammar)
+{
+    std::string alphabet = "aZ09 -.:/%\"\r\n";
+
+    std::vector<const std::string*> syntaxes;
+    for(auto it = grammar.rules.begin(); it != grammar.rules.end(); it++)
+        syntaxes.push_back(&*it);
+    syntaxes.push_back(&grammar.entry);
+
+    // bytes inside quotes
+    for(auto it = syntaxes.begin(); it != syntaxes.end(); it++)
+    {
+        bool quoted = false;
+        for(auto jt = (*it)->begin(); jt != (*it)->end(); jt++)
+        {
+            if(*jt == '\"')
+                quoted = !quoted;
+            else if(quoted && alphabet.find(*jt) == std::string::npos)
+                alphabet += *jt;
+        }
+    }
+
+    return alphabet;
+}
+
+std::string abnf_differential::random_input(std::mt19937& rng, const std::string& alphabet, size_t max_size)
+{
+    std::string input;
+    for(size_t i = 0, n = pick(rng, max_size + 1); i < n; i++)
+        input += alphabet[pick(rng, alphabet.size())];
+    return input;
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "abnf_cache.h"
+#include <random>
+
+// differential checker of the execution engines. the same grammar is built
+// for every engine, and each input is run by all of them against the tree
+// walker as the reference. inputs on which the engines disagree or an
+// engine is much slower than the reference are kept in a corpus.
+// random grammars and mutations of seed grammars can be generated for fuzzing
+class abnf_differential
+{
+public:
+    enum engine_t {TREE_WALKER, OPTIMIZED, DFA, MACHINE, MEMO, CACHE, ENGINE_COUNT};
+
+    struct grammar_t
+    {
+        // rules in the order they are added
+        std::vector<std::string> rules;
+        std::vector<bool> store_matched;
+        std::string entry;
+    };
+    struct case_t
+    {
+        grammar_t grammar;
+        std::string input;
+        std::string reason;
+    };
+    struct report_t
+    {
+        bool agreed;
+        // engine that disagreed with the reference first, or ENGINE_COUNT
+        engine_t engine;
+        double seconds[ENGINE_COUNT];
+    };
+private:
+    grammar_t grammar;
+    // the parsers are modified differently for each engine
+    boost::shared_ptr<abnf_parser> reference, optimized, dfa;
+    boost::shared_ptr<abnf_machine> machine;
+    boost::shared_ptr<abnf_cache> cache;
+
+    bool build(abnf_parser&) const;
+    void keep(const std::string& input, const std::string& reason);
+public:
+    // an engine slower than slow_factor times the reference, and slower
+    // than min_seconds, is an outlier
+    double slow_factor, min_seconds;
+    // an input that runs longer than this on any engine is pathological
+    double max_seconds;
+    std::vector<case_t> corpus;
+
+    abnf_differential();
+
+    // builds the engines; returns false if the grammar can't be generated
+    bool load(const grammar_t&);
+    report_t run(const std::string& input);
+
+    // writes the corpus as abnf with the inputs and reasons as comments
+    void write_corpus(std::ostream&) const;
+    // reads the cases written by write_corpus
+    static std::vector<case_t> read_corpus(std::istream&);
+    static const char* get_engine_name(engine_t);
+
+    static grammar_t random_grammar(std::mt19937&);
+    // makes a small syntactic change; the result might not be valid abnf
+    static grammar_t mutate_grammar(std::mt19937&, const grammar_t&);
+    // grammars from rfcs to be mutated
+    static std::vector<grammar_t> seed_grammars();
+    // bytes of the literals of the grammar and some common bytes
+    static std::string get_alphabet(const grammar_t&);
+    static std::string random_input(std::mt19937&, const std::string& alphabet, size_t max_size);
+};
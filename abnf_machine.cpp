@@ -0,0 +1,947 @@
+#include "abnf_machine.h"
+#include <algorithm>
+#include <cassert>
+
+// compilation of the generated elements
+
+void abnf_element::compile(abnf_program& program) const
+{
+    assert(this->element.get());
+
+    if(!this->is_option)
+    {
+        this->element->compile(program);
+        return;
+    }
+
+    int choice = program.emit(abnf_program::OP_CHOICE);
+    this->element->compile(program);
+    int commit = program.emit(abnf_program::OP_COMMIT);
+    program.patch(choice);
+    program.patch(commit);
+}
+
+void abnf_vals::compile(abnf_program& program) const
+{
+    if(this->type == CHAR_VAL)
+    {
+        program.emit(abnf_program::OP_CHAR_VAL,
+            program.add_literal(this->char_val), 0, this->sensitive);
+    }
+    else if(this->type == RANGE_VAL)
+    {
+        // the tree walker compares the numerals truncated to char
+        std::bitset<256> range;
+        for(int i = this->range.first; i <= this->range.second && !range.all(); i++)
+            range.set((unsigned char)i);
+        program.emit(abnf_program::OP_CLASS, program.add_class(range));
+    }
+}
+
+void abnf_class::compile(abnf_program& program) const
+{
+    program.emit(abnf_program::OP_CLASS, program.add_class(this->bytes));
+}
+
+void abnf_rulename::compile(abnf_program& program) const
+{
+    assert(this->rule);
+    program.emit(abnf_program::OP_CALL, program.add_rule(this->rule));
+}
+
+void abnf_repetition::compile(abnf_program& program) const
+{
+    if(!this->has_repeat)
+    {
+        this->element.compile(program);
+        return;
+    }
+
+    program.emit(abnf_program::OP_REP_BEGIN);
+    if(this->repetitions.second != 0)
+    {
+        int loop = program.emit(abnf_program::OP_CHOICE);
+        this->element.compile(program);
+        program.emit(abnf_program::OP_REP_NEXT, loop, this->repetitions.second);
+        program.patch(loop);
+    }
+    program.emit(abnf_program::OP_REP_END, this->repetitions.first, this->repetitions.second);
+}
+
+void abnf_concatenation::compile(abnf_program& program) const
+{
+    this->left.compile(program);
+    for(auto it = this->right.begin(); it != this->right.end(); it++)
+        it->compile(program);
+}
+
+void abnf_alternation::compile(abnf_program& program) const
+{
+    if(this->right.empty())
+    {
+        this->left.compile(program);
+        return;
+    }
+
+    std::vector<int> commits;
+
+    int choice = program.emit(abnf_program::OP_CHOICE);
+    this->left.compile(program);
+    commits.push_back(program.emit(abnf_program::OP_COMMIT));
+    program.patch(choice);
+
+    for(auto it = this->right.begin(); it != this->right.end(); it++)
+    {
+        bool last = (it + 1 == this->right.end());
+        if(!last)
+            choice = program.emit(abnf_program::OP_CHOICE);
+        it->compile(program);
+        if(!last)
+        {
+            commits.push_back(program.emit(abnf_program::OP_COMMIT));
+            program.patch(choice);
+        }
+    }
+
+    for(auto it = commits.begin(); it != commits.end(); it++)
+        program.patch(*it);
+}
+
+void abnf_rule::compile(abnf_program& program) const
+{
+    assert(this->generated);
+
+    // the rule info must be filled before the body adds new rules
+    int index = program.add_rule(this);
+    program.rules[index].rulename = this->rulename;
+    program.rules[index].store_matched = this->store_matched;
+    program.rules[index].address = (int)program.code.size();
+
+    if(this->dfa)
+        program.emit(abnf_program::OP_DFA, program.add_dfa(this->dfa));
+    else
+        this->alternation.compile(program);
+    program.emit(abnf_program::OP_RETURN);
+}
+
+void abnf_parser::compile(abnf_program& program) const
+{
+    program.emit(abnf_program::OP_CALL, program.add_rule(&this->entry));
+    program.emit(abnf_program::OP_END);
+
+    // referenced rules are appended while compiling
+    for(size_t i = 0; i < program.rules.size(); i++)
+        if(program.rules[i].address < 0)
+            program.rules[i].rule->compile(program);
+}
+
+// program
+
+abnf_program::abnf_program(const abnf_parser& parser)
+{
+    parser.compile(*this);
+}
+
+int abnf_program::emit(opcode_t op, int a, int b, bool sensitive)
+{
+    instruction ins;
+    ins.op = op;
+    ins.a = a;
+    ins.b = b;
+    ins.sensitive = sensitive;
+    this->code.push_back(ins);
+    return (int)this->code.size() - 1;
+}
+
+int abnf_program::add_rule(const abnf_rule* rule)
+{
+    for(size_t i = 0; i < this->rules.size(); i++)
+        if(this->rules[i].rule == rule)
+            return (int)i;
+
+    rule_info info;
+    info.rule = rule;
+    info.store_matched = false;
+    info.address = -1;
+    this->rules.push_back(info);
+    return (int)this->rules.size() - 1;
+}
+
+int abnf_program::add_literal(const std::string& literal)
+{
+    this->literals.push_back(literal);
+    return (int)this->literals.size() - 1;
+}
+
+int abnf_program::add_class(const std::bitset<256>& byte_class)
+{
+    for(size_t i = 0; i < this->classes.size(); i++)
+        if(this->classes[i] == byte_class)
+            return (int)i;
+
+    this->classes.push_back(byte_class);
+    return (int)this->classes.size() - 1;
+}
+
+int abnf_program::add_dfa(const boost::shared_ptr<const abnf_dfa>& dfa)
+{
+    this->dfas.push_back(dfa);
+    return (int)this->dfas.size() - 1;
+}
+
+void abnf_program::patch(int address)
+{
+    this->code[address].a = (int)this->code.size();
+}
+
+// machine
+
+const size_t abnf_machine::default_max_depth;
+const size_t abnf_machine::deadline_interval;
+const int abnf_machine::memo_iterations;
+
+abnf_machine::abnf_machine(const abnf_parser& parser, size_t max_depth) :
+    program(parser),
+    max_depth(max_depth),
+    max_steps(0),
+    max_backtracks(0),
+    deadline(clock_t::time_point::max()),
+    stack(abnf_std_allocator<frame>(parser.get_allocator())),
+    captures(abnf_std_allocator<capture>(parser.get_allocator())),
+    memo(NULL),
+    furthest(0),
+    calls(abnf_std_allocator<memo_call>(parser.get_allocator())),
+    loops(abnf_std_allocator<memo_loop>(parser.get_allocator())),
+    loop_depth(0)
+{
+    this->stats.steps = 0;
+    this->stats.backtracks = 0;
+    this->stats.peak_depth = 0;
+    this->stats.scratch_bytes = 0;
+    this->stats.capture_bytes = 0;
+}
+
+bool abnf_machine::push(frame::kind_t kind, int address, int value, const str_const_iterator& pos)
+{
+    if(this->stack.size() >= this->max_depth)
+        return false;
+
+    frame f;
+    f.kind = kind;
+    f.address = address;
+    f.value = value;
+    f.pos = pos;
+    this->stack.push_back(f);
+    if(this->stack.size() > this->stats.peak_depth)
+        this->stats.peak_depth = this->stack.size();
+    return true;
+}
+
+void abnf_machine::store_captures(matched_patterns_t& out) const
+{
+    // captures are stored in the order the rules returned,
+    // same as the tree walker does
+    for(auto it = this->captures.begin(); it != this->captures.end(); it++)
+        out[this->program.rules[it->rule].rulename].assign(it->begin, it->end);
+}
+
+abnf_machine::result_t abnf_machine::run(const std::string& input, matched_patterns_t& out)
+{
+    str_const_iterator it = input.begin();
+    return this->run(it, input.end(), out);
+}
+
+void abnf_machine::update_memory_stats()
+{
+    // the captures only grow during a run
+    this->stats.scratch_bytes = this->stats.peak_depth * sizeof(frame);
+    this->stats.capture_bytes = this->captures.size() * sizeof(capture);
+}
+
+void abnf_machine::read(const str_const_iterator& pos, const str_const_iterator& end, size_t n)
+{
+    size_t extent = ((size_t)(end - pos) >= n) ? (pos - this->base) + n : (end - this->base) + 1;
+    this->furthest = std::max(this->furthest, extent);
+}
+
+bool abnf_machine::recall(int rule, str_const_iterator& pos, bool& matched)
+{
+    size_t start = pos - this->base;
+    const abnf_memo::result* result = this->memo->find(rule, start);
+    if(!result)
+        return false;
+
+    for(auto it = result->captures.begin(); it != result->captures.end(); it++)
+    {
+        capture c = {it->rule, pos + it->begin, pos + it->end};
+        this->captures.push_back(c);
+    }
+    this->furthest = std::max(this->furthest, start + result->extent);
+    matched = result->matched;
+    if(matched)
+        pos += result->end;
+    return true;
+}
+
+void abnf_machine::remember(const frame& call, bool matched, const str_const_iterator& pos)
+{
+    assert(call.kind == frame::CALL && !this->calls.empty());
+    const memo_call& info = this->calls.back();
+    size_t start = call.pos - this->base;
+
+    abnf_memo::result result;
+    result.rule = call.value;
+    result.iterations = 0;
+    result.matched = matched;
+    result.end = matched ? pos - call.pos : 0;
+    result.extent = this->furthest - start;
+    for(size_t i = info.captures; i < this->captures.size(); i++)
+    {
+        abnf_memo::capture c = {this->captures[i].rule,
+            (size_t)(this->captures[i].begin - call.pos), (size_t)(this->captures[i].end - call.pos)};
+        result.captures.push_back(c);
+    }
+    this->memo->add(start, result);
+
+    this->furthest = std::max(this->furthest, info.furthest);
+    this->calls.pop_back();
+}
+
+bool abnf_machine::is_memoized(int rule) const
+{
+    int address = this->program.rules[rule].address;
+    abnf_program::opcode_t op = this->program.code[address].op;
+    return !((op == abnf_program::OP_CLASS || op == abnf_program::OP_CHAR_VAL) &&
+        this->program.code[address + 1].op == abnf_program::OP_RETURN);
+}
+
+namespace
+{
+
+// keeps the last capture of each rule
+void merge_captures(std::vector<abnf_memo::capture>& into, const abnf_memo::capture& c)
+{
+    for(auto it = into.begin(); it != into.end(); it++)
+        if(it->rule == c.rule)
+        {
+            into.erase(it);
+            break;
+        }
+    into.push_back(c);
+}
+
+}
+
+bool abnf_machine::recall_iterations(int loop, str_const_iterator& pos, int& count, int max)
+{
+    size_t start = pos - this->base;
+    const std::vector<abnf_memo::result>* results = this->memo->find(start);
+    if(!results)
+        return false;
+
+    const abnf_memo::result* best = NULL;
+    for(auto it = results->begin(); it != results->end(); it++)
+    {
+        if(it->rule != -1 - loop || count % it->iterations != 0)
+            continue;
+        if(max != -1 && count + it->iterations > (size_t)max)
+            continue;
+        if(!best || it->iterations > best->iterations)
+            best = &*it;
+    }
+    if(!best)
+        return false;
+
+    std::vector<abnf_memo::capture> captured;
+    for(auto it = best->captures.begin(); it != best->captures.end(); it++)
+    {
+        capture c = {it->rule, pos + it->begin, pos + it->end};
+        this->captures.push_back(c);
+        abnf_memo::capture absolute = {it->rule, start + it->begin, start + it->end};
+        captured.push_back(absolute);
+    }
+    this->furthest = std::max(this->furthest, start + best->extent);
+    size_t iterations = best->iterations;
+    pos += best->end;
+    count += (int)iterations;
+
+    this->remember_iterations(loop, count, iterations, start, captured, pos, false);
+    return true;
+}
+
+void abnf_machine::remember_iterations(int loop, size_t count, size_t iterations, size_t start,
+    std::vector<abnf_memo::capture>& captures, const str_const_iterator& pos, bool store)
+{
+    assert(this->loop_depth > 0 && count % iterations == 0);
+    memo_loop& l = this->loops[this->loop_depth - 1];
+    size_t end = pos - this->base;
+
+    size_t level = 0;
+    while(((size_t)memo_iterations << level) < iterations)
+        level++;
+
+    for(;; level++)
+    {
+        if(store)
+        {
+            abnf_memo::result result;
+            result.rule = -1 - loop;
+            result.iterations = iterations;
+            result.matched = true;
+            result.end = end - start;
+            result.extent = this->furthest - start;
+            result.captures = captures;
+            for(auto it = result.captures.begin(); it != result.captures.end(); it++)
+            {
+                it->begin -= start;
+                it->end -= start;
+            }
+            this->memo->add(start, result);
+        }
+        store = true;
+
+        // the first half of a longer run
+        if(count % (iterations * 2) != 0)
+        {
+            if(l.halves.size() <= level)
+                l.halves.resize(level + 1);
+            l.halves[level].start = start;
+            l.halves[level].captures.swap(captures);
+            return;
+        }
+
+        // the second half
+        assert(level < l.halves.size());
+        memo_loop::half& first = l.halves[level];
+        for(auto it = captures.begin(); it != captures.end(); it++)
+            merge_captures(first.captures, *it);
+        captures.swap(first.captures);
+        start = first.start;
+        iterations *= 2;
+    }
+}
+
+abnf_machine::result_t abnf_machine::run(
+    str_const_iterator& it, const str_const_iterator& end, matched_patterns_t& out)
+{
+    this->memo = NULL;
+    result_t result = this->execute(it, end, out);
+    this->update_memory_stats();
+    return result;
+}
+
+abnf_machine::result_t abnf_machine::run(const std::string& input, matched_patterns_t& out, abnf_memo& memo)
+{
+    // the memo belongs to another input
+    if(memo.get_size() != input.size())
+        memo.reset(input.size());
+
+    this->memo = &memo;
+    this->base = input.begin();
+    this->furthest = 0;
+    this->calls.clear();
+
+    str_const_iterator it = input.begin();
+    result_t result = this->execute(it, input.end(), out);
+    this->update_memory_stats();
+    this->memo = NULL;
+    return result;
+}
+
+abnf_machine::result_t abnf_machine::execute(
+    str_const_iterator& it, const str_const_iterator& end, matched_patterns_t& out)
+{
+    this->stack.clear();
+    this->captures.clear();
+    this->loop_depth = 0;
+    this->stats.steps = 0;
+    this->stats.backtracks = 0;
+    this->stats.peak_depth = 0;
+
+    // the budget is checked against a single counter in the loop
+    const size_t no_limit = (size_t)-1;
+    const bool has_deadline = (this->deadline != clock_t::time_point::max());
+    const size_t max_steps = this->max_steps ? this->max_steps : no_limit;
+    const size_t max_backtracks = this->max_backtracks ? this->max_backtracks : no_limit;
+    size_t check_at = has_deadline ? std::min(max_steps, deadline_interval) : max_steps;
+
+    str_const_iterator jt = it;
+    int pc = 0;
+
+    for(;;)
+    {
+        // automatons can move the counter past the check
+        if(this->stats.steps >= check_at)
+        {
+            if(this->stats.steps >= max_steps || clock_t::now() >= this->deadline)
+                return BUDGET_EXCEEDED;
+            check_at = std::min(max_steps, this->stats.steps + deadline_interval);
+        }
+        this->stats.steps++;
+
+        const abnf_program::instruction& ins = this->program.code[pc];
+        bool matched = true;
+
+        switch(ins.op)
+        {
+        case abnf_program::OP_CHAR_VAL:
+            {
+                const std::string& literal = this->program.literals[ins.a];
+                if(this->memo)
+                    this->read(jt, end, literal.size());
+                if(match_literal(literal, ins.sensitive, jt, end))
+                    pc++;
+                else
+                    matched = false;
+            }
+            break;
+        case abnf_program::OP_CLASS:
+            if(this->memo)
+                this->read(jt, end, 1);
+            if(jt != end && this->program.classes[ins.a].test((unsigned char)*jt))
+            {
+                jt++;
+                pc++;
+            }
+            else
+                matched = false;
+            break;
+        case abnf_program::OP_CHOICE:
+            // the choice of a loop can skip the iterations stored in the memo
+            if(this->memo && this->program.code[ins.a].op == abnf_program::OP_REP_END)
+            {
+                assert(this->stack.back().kind == frame::COUNTER);
+                int& count = this->stack.back().value;
+                if(count % memo_iterations == 0)
+                {
+                    int max = this->program.code[ins.a].b;
+                    if(this->recall_iterations(pc, jt, count, max))
+                    {
+                        if(count == max)
+                            pc = ins.a;
+                        break;
+                    }
+                    memo_loop& l = this->loops[this->loop_depth - 1];
+                    l.start = jt - this->base;
+                    l.captures = this->captures.size();
+                }
+            }
+            if(!this->push(frame::BACKTRACK, ins.a, 0, jt))
+                return DEPTH_EXCEEDED;
+            pc++;
+            break;
+        case abnf_program::OP_COMMIT:
+            assert(this->stack.back().kind == frame::BACKTRACK);
+            this->stack.pop_back();
+            pc = ins.a;
+            break;
+        case abnf_program::OP_CALL:
+            if(this->memo && this->is_memoized(ins.a))
+            {
+                if(this->recall(ins.a, jt, matched))
+                {
+                    if(matched)
+                        pc++;
+                    break;
+                }
+                memo_call call = {this->captures.size(), this->furthest};
+                this->calls.push_back(call);
+                this->furthest = jt - this->base;
+            }
+            if(!this->push(frame::CALL, pc + 1, ins.a, jt))
+                return DEPTH_EXCEEDED;
+            pc = this->program.rules[ins.a].address;
+            break;
+        case abnf_program::OP_RETURN:
+            {
+                assert(this->stack.back().kind == frame::CALL);
+                const frame& f = this->stack.back();
+                if(this->program.rules[f.value].store_matched)
+                {
+                    capture c = {f.value, f.pos, jt};
+                    this->captures.push_back(c);
+                }
+                if(this->memo && this->is_memoized(f.value))
+                    this->remember(f, true, jt);
+                pc = f.address;
+                this->stack.pop_back();
+            }
+            break;
+        case abnf_program::OP_REP_BEGIN:
+            if(!this->push(frame::COUNTER, 0, 0, jt))
+                return DEPTH_EXCEEDED;
+            if(this->memo && this->loop_depth++ == this->loops.size())
+                this->loops.push_back(memo_loop());
+            pc++;
+            break;
+        case abnf_program::OP_REP_NEXT:
+            {
+                assert(this->stack.back().kind == frame::BACKTRACK);
+                bool empty = (this->stack.back().pos == jt);
+                this->stack.pop_back();
+                assert(this->stack.back().kind == frame::COUNTER);
+                int& count = this->stack.back().value;
+                count++;
+
+                // the loop ends at the maximum count or after an empty match,
+                // same as the tree walker
+                int exit = this->program.code[ins.a].a;
+                if(empty)
+                {
+                    count = std::max(count, this->program.code[exit].a);
+                    pc = exit;
+                }
+                else
+                {
+                    pc = (count == ins.b) ? exit : ins.a;
+                    if(this->memo && count % memo_iterations == 0)
+                    {
+                        const memo_loop& l = this->loops[this->loop_depth - 1];
+                        std::vector<abnf_memo::capture> captured;
+                        for(size_t i = l.captures; i < this->captures.size(); i++)
+                        {
+                            abnf_memo::capture c = {this->captures[i].rule,
+                                (size_t)(this->captures[i].begin - this->base),
+                                (size_t)(this->captures[i].end - this->base)};
+                            merge_captures(captured, c);
+                        }
+                        this->remember_iterations(ins.a, count, memo_iterations, l.start, captured, jt, true);
+                    }
+                }
+            }
+            break;
+        case abnf_program::OP_REP_END:
+            {
+                assert(this->stack.back().kind == frame::COUNTER);
+                int count = this->stack.back().value;
+                this->stack.pop_back();
+                if(this->memo)
+                    this->loop_depth--;
+                if(count < ins.a)
+                    matched = false;
+                else
+                    pc++;
+            }
+            break;
+        case abnf_program::OP_DFA:
+            {
+                // a step is charged for each byte the automaton reads, so it
+                // reads no further than the budget left
+                str_const_iterator from = jt, last, until = end;
+                if(max_steps != no_limit && (size_t)(end - jt) > max_steps - this->stats.steps)
+                    until = jt + (max_steps - this->stats.steps);
+                if(this->program.dfas[ins.a]->run(jt, until, last))
+                    pc++;
+                else
+                    matched = false;
+                this->stats.steps += (size_t)(last - from);
+                if(last == until && until != end)
+                    return BUDGET_EXCEEDED;
+                if(this->memo)
+                    this->furthest = std::max(this->furthest, (size_t)(last - this->base) + 1);
+            }
+            break;
+        case abnf_program::OP_END:
+            this->store_captures(out);
+            it = jt;
+            return MATCHED;
+        }
+
+        if(matched)
+            continue;
+
+        // unwind to the latest alternative
+        while(!this->stack.empty() && this->stack.back().kind != frame::BACKTRACK)
+        {
+            const frame& f = this->stack.back();
+            if(this->memo && f.kind == frame::CALL && this->is_memoized(f.value))
+                this->remember(f, false, jt);
+            else if(this->memo && f.kind == frame::COUNTER)
+                this->loop_depth--;
+            this->stack.pop_back();
+        }
+        if(this->stack.empty())
+        {
+            this->store_captures(out);
+            return NOT_MATCHED;
+        }
+        if(this->stats.backtracks == max_backtracks)
+            return BUDGET_EXCEEDED;
+        this->stats.backtracks++;
+        jt = this->stack.back().pos;
+        pc = this->stack.back().address;
+        this->stack.pop_back();
+    }
+}
+
+// memo
+
+abnf_memo::abnf_memo() :
+    root(-1),
+    size(0),
+    count(0),
+    seed(2463534242u)
+{
+}
+
+void abnf_memo::reset(size_t size)
+{
+    this->nodes.clear();
+    this->free_nodes.clear();
+    this->root = -1;
+    this->size = size;
+    this->count = 0;
+}
+
+int abnf_memo::make_node(size_t start)
+{
+    // xorshift
+    this->seed ^= this->seed << 13;
+    this->seed ^= this->seed >> 17;
+    this->seed ^= this->seed << 5;
+
+    int n;
+    if(!this->free_nodes.empty())
+    {
+        n = this->free_nodes.back();
+        this->free_nodes.pop_back();
+    }
+    else
+    {
+        this->nodes.push_back(node());
+        n = (int)this->nodes.size() - 1;
+    }
+
+    node& x = this->nodes[n];
+    x.start = start;
+    x.reach = start;
+    x.shift = 0;
+    x.priority = this->seed;
+    x.left = -1;
+    x.right = -1;
+    return n;
+}
+
+void abnf_memo::free_tree(int n)
+{
+    if(n < 0)
+        return;
+
+    node& x = this->nodes[n];
+    int left = x.left, right = x.right;
+    this->count -= x.results.size();
+    std::vector<result>().swap(x.results);
+    this->free_nodes.push_back(n);
+
+    this->free_tree(left);
+    this->free_tree(right);
+}
+
+void abnf_memo::apply(int n, ptrdiff_t shift)
+{
+    if(n < 0)
+        return;
+
+    node& x = this->nodes[n];
+    x.start += shift;
+    x.reach += shift;
+    x.shift += shift;
+}
+
+void abnf_memo::push(int n)
+{
+    node& x = this->nodes[n];
+    if(!x.shift)
+        return;
+
+    this->apply(x.left, x.shift);
+    this->apply(x.right, x.shift);
+    x.shift = 0;
+}
+
+void abnf_memo::update(int n)
+{
+    node& x = this->nodes[n];
+    x.reach = x.start;
+    for(auto it = x.results.begin(); it != x.results.end(); it++)
+        x.reach = std::max(x.reach, x.start + it->extent);
+    if(x.left >= 0)
+        x.reach = std::max(x.reach, this->nodes[x.left].reach);
+    if(x.right >= 0)
+        x.reach = std::max(x.reach, this->nodes[x.right].reach);
+}
+
+void abnf_memo::split(int n, size_t start, int& left, int& right)
+{
+    if(n < 0)
+    {
+        left = -1;
+        right = -1;
+        return;
+    }
+
+    this->push(n);
+    int l, r;
+    if(this->nodes[n].start < start)
+    {
+        this->split(this->nodes[n].right, start, l, r);
+        this->nodes[n].right = l;
+        left = n;
+        right = r;
+    }
+    else
+    {
+        this->split(this->nodes[n].left, start, l, r);
+        this->nodes[n].left = r;
+        left = l;
+        right = n;
+    }
+    this->update(n);
+}
+
+int abnf_memo::merge(int left, int right)
+{
+    if(left < 0)
+        return right;
+    if(right < 0)
+        return left;
+
+    if(this->nodes[left].priority > this->nodes[right].priority)
+    {
+        this->push(left);
+        int merged = this->merge(this->nodes[left].right, right);
+        this->nodes[left].right = merged;
+        this->update(left);
+        return left;
+    }
+
+    this->push(right);
+    int merged = this->merge(left, this->nodes[right].left);
+    this->nodes[right].left = merged;
+    this->update(right);
+    return right;
+}
+
+int abnf_memo::prune(int n, size_t offset)
+{
+    // nothing below the node read past the offset
+    if(n < 0 || this->nodes[n].reach <= offset)
+        return n;
+
+    this->push(n);
+    int left = this->prune(this->nodes[n].left, offset);
+    int right = this->prune(this->nodes[n].right, offset);
+
+    node& x = this->nodes[n];
+    x.left = left;
+    x.right = right;
+    for(size_t i = 0; i < x.results.size();)
+    {
+        if(x.start + x.results[i].extent > offset)
+        {
+            x.results[i] = x.results.back();
+            x.results.pop_back();
+            this->count--;
+        }
+        else
+            i++;
+    }
+
+    if(x.results.empty())
+    {
+        std::vector<result>().swap(x.results);
+        this->free_nodes.push_back(n);
+        return this->merge(left, right);
+    }
+    this->update(n);
+    return n;
+}
+
+const std::vector<abnf_memo::result>* abnf_memo::find(size_t start)
+{
+    int n = this->root;
+    while(n >= 0)
+    {
+        this->push(n);
+        const node& x = this->nodes[n];
+        if(x.start == start)
+            return &x.results;
+        n = (start < x.start) ? x.left : x.right;
+    }
+    return NULL;
+}
+
+const abnf_memo::result* abnf_memo::find(int rule, size_t start)
+{
+    const std::vector<result>* results = this->find(start);
+    if(!results)
+        return NULL;
+
+    for(auto it = results->begin(); it != results->end(); it++)
+        if(it->rule == rule && !it->iterations)
+            return &*it;
+    return NULL;
+}
+
+void abnf_memo::add(size_t start, const result& r)
+{
+    int left, middle, right;
+    this->split(this->root, start, left, right);
+    this->split(right, start + 1, middle, right);
+    if(middle < 0)
+        middle = this->make_node(start);
+
+    std::vector<result>& results = this->nodes[middle].results;
+    auto it = results.begin();
+    while(it != results.end() && (it->rule != r.rule || it->iterations != r.iterations))
+        it++;
+    if(it != results.end())
+        *it = r;
+    else
+    {
+        results.push_back(r);
+        this->count++;
+    }
+
+    this->update(middle);
+    this->root = this->merge(this->merge(left, middle), right);
+}
+
+void abnf_memo::edit(size_t offset, size_t removed, size_t inserted)
+{
+    // nothing has been stored yet
+    if(this->root < 0)
+        return;
+    assert(offset + removed <= this->size);
+
+    // a call only depends on the bytes it read, so the results that start
+    // after the replaced bytes stay valid
+    int left, middle, right;
+    this->split(this->root, offset, left, right);
+    this->split(right, offset + removed, middle, right);
+    this->free_tree(middle);
+    this->apply(right, (ptrdiff_t)inserted - (ptrdiff_t)removed);
+    left = this->prune(left, offset);
+    this->root = this->merge(left, right);
+    this->size = this->size - removed + inserted;
+}
+
+// document
+
+abnf_document::abnf_document(const abnf_parser& parser, const std::string& text) :
+    machine(parser),
+    text(text)
+{
+}
+
+void abnf_document::edit(size_t offset, size_t removed, const std::string& inserted)
+{
+    assert(offset + removed <= this->text.size());
+    this->text.replace(offset, removed, inserted);
+    this->memo.edit(offset, removed, inserted.size());
+}
+
+abnf_machine::result_t abnf_document::parse(matched_patterns_t& out)
+{
+    return this->machine.run(this->text, out, this->memo);
+}
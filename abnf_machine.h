@@ -0,0 +1,288 @@
+#pragma once
+
+#include "abnf_parser.h"
+#include "abnf_dfa.h"
+#include <bitset>
+#include <chrono>
+
+// flat instruction form of a generated grammar.
+// every rule is compiled once into a subroutine that is called by index
+class abnf_program
+{
+public:
+    enum opcode_t
+    {
+        OP_CHAR_VAL,    // a: literal index, sensitive: case sensitivity
+        OP_CLASS,       // a: class index; matches a single byte
+        OP_CHOICE,      // a: address of the alternative
+        OP_COMMIT,      // a: address to continue from
+        OP_CALL,        // a: rule index
+        OP_RETURN,
+        OP_REP_BEGIN,
+        OP_REP_NEXT,    // a: address of the loop, b: maximum count or -1
+        OP_REP_END,     // a: minimum count, b: maximum count or -1
+        OP_DFA,         // a: automaton index
+        OP_END
+    };
+
+    struct instruction
+    {
+        opcode_t op;
+        int a, b;
+        bool sensitive;
+    };
+
+    struct rule_info
+    {
+        const abnf_rule* rule;
+        std::string rulename;
+        bool store_matched;
+        // negative until the rule has been compiled
+        int address;
+    };
+
+    std::vector<instruction> code;
+    std::vector<std::string> literals;
+    std::vector<std::bitset<256> > classes;
+    std::vector<boost::shared_ptr<const abnf_dfa> > dfas;
+    // the first rule is the entry object of the parser
+    std::vector<rule_info> rules;
+
+    explicit abnf_program(const abnf_parser&);
+
+    // returns the address of the instruction
+    int emit(opcode_t, int a = 0, int b = 0, bool sensitive = true);
+    // returns the index of the rule; new rules are compiled after the current one
+    int add_rule(const abnf_rule*);
+    int add_literal(const std::string&);
+    int add_class(const std::bitset<256>&);
+    int add_dfa(const boost::shared_ptr<const abnf_dfa>&);
+    // sets the jump target of the instruction to the next address
+    void patch(int address);
+};
+
+// results of the rule calls and loop iterations of earlier runs over the same
+// input. the end of a result and the end of the input it read are relative
+// to its start. the results are kept in a tree ordered by their start that
+// also knows the furthest byte read below each node, so an edit only visits
+// the results that read the edited bytes, and the starts after the edit are
+// moved in logarithmic time
+class abnf_memo
+{
+public:
+    struct capture
+    {
+        int rule;
+        size_t begin, end;
+    };
+    struct result
+    {
+        // rule index, or a loop key for runs of loop iterations
+        int rule;
+        // number of loop iterations, 0 for rule calls
+        size_t iterations;
+        bool matched;
+        // reading the end of the input counts as reading one byte past it
+        size_t end, extent;
+        // the captures stored by the call and its subcalls; runs of
+        // iterations only keep the last capture of each rule
+        std::vector<capture> captures;
+    };
+private:
+    struct node
+    {
+        // start and the furthest byte read by the results of the subtree;
+        // the shifts of the ancestors haven't been applied yet
+        size_t start, reach;
+        // shift of the starts in the subtrees of the children
+        ptrdiff_t shift;
+        unsigned int priority;
+        int left, right;
+        std::vector<result> results;
+    };
+
+    std::vector<node> nodes;
+    std::vector<int> free_nodes;
+    int root;
+    size_t size, count;
+    unsigned int seed;
+
+    int make_node(size_t start);
+    void free_tree(int);
+    void apply(int, ptrdiff_t shift);
+    void push(int);
+    void update(int);
+    // splits the tree into the starts before start and the rest
+    void split(int, size_t start, int& left, int& right);
+    int merge(int left, int right);
+    // drops the results that read past offset; returns the new subtree
+    int prune(int, size_t offset);
+public:
+    abnf_memo();
+
+    // length of the input the results belong to
+    size_t get_size() const {return this->size;}
+    // drops all the results
+    void reset(size_t size);
+
+    // NULL if no results start at start
+    const std::vector<result>* find(size_t start);
+    const result* find(int rule, size_t start);
+    // replaces the result of the same rule and iterations
+    void add(size_t start, const result&);
+    // drops the results that read the replaced bytes and moves the results after them
+    void edit(size_t offset, size_t removed, size_t inserted);
+    size_t count_results() const {return this->count;}
+};
+
+// iterative execution engine for compiled grammars. backtracking state is
+// kept in an explicit stack that is reused between runs, so the native stack
+// usage doesn't depend on the grammar or the input.
+// a machine isn't thread safe; use one machine per thread
+class abnf_machine
+{
+public:
+    enum result_t {MATCHED, NOT_MATCHED, DEPTH_EXCEEDED, BUDGET_EXCEEDED};
+    typedef std::chrono::steady_clock clock_t;
+
+    // counters of the latest run
+    struct stats_t
+    {
+        // executed instructions and bytes read by automatons
+        size_t steps;
+        // returns to an earlier alternative
+        size_t backtracks;
+        // deepest backtracking stack, in frames
+        size_t peak_depth;
+        // peak memory used by the backtracking stack and the captures
+        size_t scratch_bytes, capture_bytes;
+    };
+    // range matched by a captured rule
+    struct capture
+    {
+        int rule;
+        str_const_iterator begin, end;
+    };
+private:
+    struct frame
+    {
+        enum kind_t {BACKTRACK, CALL, COUNTER};
+        kind_t kind;
+        // backtrack: address of the alternative, call: return address
+        // and the rule index, counter: the repetition count
+        int address, value;
+        str_const_iterator pos;
+    };
+    // rule call that is stored to the memo when it returns or fails
+    struct memo_call
+    {
+        size_t captures, furthest;
+    };
+    // loop whose runs of iterations are stored to the memo. a run of
+    // memo_iterations << n iterations starts at a count that is a multiple
+    // of its length, and is stored when its second half finishes
+    struct memo_loop
+    {
+        struct half
+        {
+            size_t start;
+            // captures relative to the base, the last one of each rule
+            std::vector<abnf_memo::capture> captures;
+        };
+
+        // start of the current shortest run and the captures before it
+        size_t start, captures;
+        // finished first halves of the longer runs, by length
+        std::vector<half> halves;
+    };
+
+    abnf_program program;
+    size_t max_depth;
+    // 0 means no limit
+    size_t max_steps, max_backtracks;
+    clock_t::time_point deadline;
+    // scratch memory comes from the allocator of the parser
+    std::vector<frame, abnf_std_allocator<frame> > stack;
+    std::vector<capture, abnf_std_allocator<capture> > captures;
+    stats_t stats;
+
+    // set during memoized runs
+    abnf_memo* memo;
+    str_const_iterator base;
+    // end of the input read by the current call, relative to base
+    size_t furthest;
+    std::vector<memo_call, abnf_std_allocator<memo_call> > calls;
+    // entries above loop_depth are kept for their capacity
+    std::vector<memo_loop, abnf_std_allocator<memo_loop> > loops;
+    size_t loop_depth;
+
+    bool push(frame::kind_t, int address, int value, const str_const_iterator& pos);
+    void store_captures(matched_patterns_t&) const;
+    void read(const str_const_iterator& pos, const str_const_iterator& end, size_t n);
+    // replays a memoized call; returns false if the call isn't memoized
+    bool recall(int rule, str_const_iterator& pos, bool& matched);
+    void remember(const frame& call, bool matched, const str_const_iterator& pos);
+    // rules made of a single matcher are cheaper to run than to look up
+    bool is_memoized(int rule) const;
+    // replays the longest memoized run of iterations that can follow count;
+    // returns false if there's none
+    bool recall_iterations(int loop, str_const_iterator& pos, int& count, int max);
+    // stores the run of iterations that ended at pos and the longer runs it finishes
+    void remember_iterations(int loop, size_t count, size_t iterations, size_t start,
+        std::vector<abnf_memo::capture>& captures, const str_const_iterator& pos, bool store);
+    result_t execute(str_const_iterator& it, const str_const_iterator& end, matched_patterns_t&);
+    void update_memory_stats();
+public:
+    static const size_t default_max_depth = 1 << 16;
+    // number of steps between the deadline checks
+    static const size_t deadline_interval = 1 << 12;
+    // shortest run of loop iterations stored to the memo
+    static const int memo_iterations = 8;
+
+    // compiles the generated grammar of the parser
+    explicit abnf_machine(const abnf_parser&, size_t max_depth = default_max_depth);
+
+    const abnf_program& get_program() const {return this->program;}
+    // maximum number of nested backtrack, call and repetition frames
+    void set_max_depth(size_t max_depth) {this->max_depth = max_depth;}
+    // runs exceeding the budget return BUDGET_EXCEEDED; 0 means no limit
+    void set_budget(size_t max_steps, size_t max_backtracks)
+    {this->max_steps = max_steps; this->max_backtracks = max_backtracks;}
+    // runs still going at the deadline return BUDGET_EXCEEDED;
+    // the deadline is checked every deadline_interval steps
+    void set_deadline(const clock_t::time_point& deadline) {this->deadline = deadline;}
+    void clear_deadline() {this->deadline = clock_t::time_point::max();}
+    const stats_t& get_stats() const {return this->stats;}
+    // captures of the latest run in the order the rules returned
+    const std::vector<capture, abnf_std_allocator<capture> >& get_captures() const {return this->captures;}
+    // memory held by the compiled program
+    abnf_footprint get_footprint() const;
+
+    // matches the same way as abnf_parser::run
+    result_t run(const std::string& input, matched_patterns_t&);
+    result_t run(str_const_iterator& it, const str_const_iterator& end, matched_patterns_t&);
+    // reuses the results of the memo and stores the new ones; the memo must
+    // have been used with the same program and, apart from the edits applied
+    // to the memo, the same input
+    result_t run(const std::string& input, matched_patterns_t&, abnf_memo&);
+};
+
+// input that is parsed again after small edits; only the rule calls that
+// read the edited bytes are run again
+class abnf_document
+{
+private:
+    abnf_machine machine;
+    abnf_memo memo;
+    std::string text;
+public:
+    abnf_document(const abnf_parser&, const std::string& text);
+
+    const std::string& get_text() const {return this->text;}
+    abnf_machine& get_machine() {return this->machine;}
+    const abnf_memo& get_memo() const {return this->memo;}
+
+    // replaces the removed bytes at offset with the inserted bytes
+    void edit(size_t offset, size_t removed, const std::string& inserted);
+    abnf_machine::result_t parse(matched_patterns_t&);
+};
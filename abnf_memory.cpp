@@ -0,0 +1,161 @@
+#include "abnf_machine.h"
+#include <cassert>
+
+// memory accounting of the generated elements
+
+namespace
+{
+
+class default_allocator : public abnf_allocator
+{
+public:
+    void* allocate(size_t size) {return ::operator new(size, std::nothrow);}
+    void deallocate(void* p, size_t) {::operator delete(p);}
+};
+
+// shared_ptr control block of the nodes; the node is allocated with it
+const size_t control_block_size = 2 * sizeof(void*) + 2 * sizeof(long);
+
+template<class T, class A>
+size_t vector_bytes(const std::vector<T, A>& v)
+{
+    return v.capacity() * sizeof(T);
+}
+
+}
+
+abnf_allocator& abnf_allocator::get_default()
+{
+    static default_allocator allocator;
+    return allocator;
+}
+
+abnf_limited_allocator::abnf_limited_allocator(size_t limit, abnf_allocator& upstream) :
+    upstream(upstream),
+    limit(limit),
+    bytes(0),
+    peak(0)
+{
+}
+
+void* abnf_limited_allocator::allocate(size_t size)
+{
+    size_t used = this->bytes.load();
+    do
+    {
+        if(this->limit && (size > this->limit || used > this->limit - size))
+            return NULL;
+    }
+    while(!this->bytes.compare_exchange_weak(used, used + size));
+
+    void* p = this->upstream.allocate(size);
+    if(!p)
+    {
+        this->bytes -= size;
+        return NULL;
+    }
+
+    // the peak may be missed by concurrent allocations by the size of one allocation
+    size_t peak = this->peak.load();
+    while(used + size > peak && !this->peak.compare_exchange_weak(peak, used + size));
+    return p;
+}
+
+void abnf_limited_allocator::deallocate(void* p, size_t size)
+{
+    this->upstream.deallocate(p, size);
+    this->bytes -= size;
+}
+
+void abnf_element::measure(abnf_footprint& footprint) const
+{
+    if(!this->element || !footprint.counted.insert(this->element.get()).second)
+        return;
+
+    footprint.nodes += this->element->get_size() + control_block_size;
+    this->element->measure(footprint);
+}
+
+void abnf_vals::measure(abnf_footprint& footprint) const
+{
+    footprint.add_string(this->char_val);
+    footprint.add_string(this->prose_val);
+}
+
+void abnf_repetition::measure(abnf_footprint& footprint) const
+{
+    this->element.measure(footprint);
+}
+
+void abnf_concatenation::measure(abnf_footprint& footprint) const
+{
+    this->left.measure(footprint);
+    footprint.nodes += vector_bytes(this->right);
+    for(auto it = this->right.begin(); it != this->right.end(); it++)
+        it->measure(footprint);
+}
+
+void abnf_alternation::measure(abnf_footprint& footprint) const
+{
+    this->left.measure(footprint);
+    footprint.nodes += vector_bytes(this->right);
+    for(auto it = this->right.begin(); it != this->right.end(); it++)
+        it->measure(footprint);
+}
+
+void abnf_rule::measure(abnf_footprint& footprint) const
+{
+    footprint.add_string(this->rulename);
+    this->alternation.measure(footprint);
+    if(this->dfa && footprint.counted.insert(this->dfa.get()).second)
+        footprint.tables += sizeof(abnf_dfa) + control_block_size + this->dfa->get_memory();
+}
+
+abnf_footprint abnf_parser::get_footprint() const
+{
+    abnf_footprint footprint;
+    footprint.nodes += sizeof(abnf_parser);
+
+    // list nodes have two links
+    const size_t list_node_size = sizeof(abnf_rule) + 2 * sizeof(void*);
+    footprint.nodes += (this->rules.size() + this->core_rules.size()) * list_node_size;
+    for(auto it = this->rules.begin(); it != this->rules.end(); it++)
+        it->measure(footprint);
+    for(auto it = this->core_rules.begin(); it != this->core_rules.end(); it++)
+        it->measure(footprint);
+    this->entry.measure(footprint);
+
+    footprint.strings += vector_bytes(this->diagnostics);
+    for(auto it = this->diagnostics.begin(); it != this->diagnostics.end(); it++)
+    {
+        footprint.add_string(it->rulename);
+        footprint.add_string(it->message);
+    }
+
+    return footprint;
+}
+
+abnf_footprint abnf_machine::get_footprint() const
+{
+    abnf_footprint footprint;
+    footprint.nodes += sizeof(abnf_machine);
+
+    footprint.nodes += vector_bytes(this->program.code) + vector_bytes(this->program.rules);
+    for(auto it = this->program.rules.begin(); it != this->program.rules.end(); it++)
+        footprint.add_string(it->rulename);
+
+    footprint.strings += vector_bytes(this->program.literals);
+    for(auto it = this->program.literals.begin(); it != this->program.literals.end(); it++)
+        footprint.add_string(*it);
+
+    footprint.tables += vector_bytes(this->program.classes) + vector_bytes(this->program.dfas);
+    for(auto it = this->program.dfas.begin(); it != this->program.dfas.end(); it++)
+        if(footprint.counted.insert(it->get()).second)
+            footprint.tables += sizeof(abnf_dfa) + control_block_size + (*it)->get_memory();
+
+    // scratch memory kept between runs
+    footprint.nodes += this->stack.capacity() * sizeof(frame) +
+        this->captures.capacity() * sizeof(capture) + this->calls.capacity() * sizeof(memo_call);
+
+    return footprint;
+}
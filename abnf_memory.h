@@ -0,0 +1,96 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <new>
+#include <set>
+#include <string>
+
+// allocator of the element nodes and automatons of a parser and the scratch
+// memory of the machines compiled from it; can be replaced with a per-tenant
+// arena.
+// allocators must be thread safe if the machines run in multiple threads
+class abnf_allocator
+{
+public:
+    virtual ~abnf_allocator() {}
+
+    // returns NULL if the allocation is refused
+    virtual void* allocate(size_t size) = 0;
+    virtual void deallocate(void* p, size_t size) = 0;
+
+    // uses the global operator new
+    static abnf_allocator& get_default();
+};
+
+// counts the allocated bytes and refuses the allocations over the limit
+class abnf_limited_allocator : public abnf_allocator
+{
+private:
+    abnf_allocator& upstream;
+    const size_t limit;
+    std::atomic<size_t> bytes, peak;
+public:
+    // 0 means no limit
+    explicit abnf_limited_allocator(size_t limit = 0,
+        abnf_allocator& upstream = abnf_allocator::get_default());
+
+    void* allocate(size_t size);
+    void deallocate(void* p, size_t size);
+
+    size_t get_bytes() const {return this->bytes;}
+    size_t get_peak() const {return this->peak;}
+};
+
+// standard allocator that uses an abnf_allocator; refused allocations
+// throw std::bad_alloc
+template<class T>
+class abnf_std_allocator
+{
+public:
+    typedef T value_type;
+
+    abnf_allocator* allocator;
+
+    explicit abnf_std_allocator(abnf_allocator& allocator) : allocator(&allocator) {}
+    template<class U>
+    abnf_std_allocator(const abnf_std_allocator<U>& other) : allocator(other.allocator) {}
+
+    T* allocate(size_t n)
+    {
+        void* p = this->allocator->allocate(n * sizeof(T));
+        if(!p)
+            throw std::bad_alloc();
+        return static_cast<T*>(p);
+    }
+    void deallocate(T* p, size_t n) {this->allocator->deallocate(p, n * sizeof(T));}
+
+    template<class U>
+    bool operator==(const abnf_std_allocator<U>& other) const {return this->allocator == other.allocator;}
+    template<class U>
+    bool operator!=(const abnf_std_allocator<U>& other) const {return this->allocator != other.allocator;}
+};
+
+// memory held by a generated grammar, in bytes
+struct abnf_footprint
+{
+    // element nodes, rules and their containers
+    size_t nodes;
+    // literals and rule names
+    size_t strings;
+    // automatons
+    size_t tables;
+    // shared nodes and automatons are counted once
+    std::set<const void*> counted;
+
+    abnf_footprint() : nodes(0), strings(0), tables(0) {}
+    size_t total() const {return this->nodes + this->strings + this->tables;}
+
+    // heap bytes of the string; short strings are stored in place
+    void add_string(const std::string& s)
+    {
+        static const size_t inline_capacity = std::string().capacity();
+        if(s.capacity() > inline_capacity)
+            this->strings += s.capacity() + 1;
+    }
+};
@@ -0,0 +1,511 @@
+#include "abnf_parser.h"
+#include <cassert>
+#include <cctype>
+#include <ostream>
+#include <iomanip>
+#include <sstream>
+
+// optimization and printing of the generated elements
+
+namespace
+{
+
+// literals without letters match the same way regardless of case sensitivity
+bool has_letters(const std::string& literal)
+{
+    for(auto it = literal.begin(); it != literal.end(); it++)
+        if(isalpha((unsigned char)*it))
+            return true;
+    return false;
+}
+
+// returns the length of the common prefix of two literals of the same sensitivity
+size_t common_prefix(const std::string& a, const std::string& b, bool sensitive)
+{
+    size_t n = 0;
+    while(n < a.size() && n < b.size() &&
+        (sensitive ? (a[n] == b[n]) : (fold_case(a[n]) == fold_case(b[n]))))
+        n++;
+    return n;
+}
+
+abnf_repetition make_literal(abnf_parser& parser, const std::string& literal, bool sensitive)
+{
+    // the literals come from folded char-vals
+    boost::shared_ptr<abnf_element> vals = parser.make_node<abnf_vals>(parser, literal, sensitive);
+    return abnf_repetition(parser, abnf_element(parser, vals, false));
+}
+
+void print_numeral(std::ostream& os, int num)
+{
+    os << std::uppercase << std::hex << std::setw(2) << std::setfill('0')
+        << num << std::dec << std::setfill(' ');
+}
+
+}
+
+void abnf_element::optimize(size_t inline_limit)
+{
+    assert(this->element.get());
+
+    const abnf_rulename* rulename = dynamic_cast<const abnf_rulename*>(this->element.get());
+    if(rulename)
+    {
+        boost::shared_ptr<abnf_element> body = rulename->get_rule()->get_inline(inline_limit);
+        if(body)
+            this->element = body;
+    }
+
+    this->element->optimize(inline_limit);
+
+    // remove groups that contain a single element
+    for(;;)
+    {
+        const abnf_alternation* group = dynamic_cast<const abnf_alternation*>(this->element.get());
+        const abnf_element* single = group ? group->get_single() : NULL;
+        if(!single)
+            break;
+
+        this->is_option = this->is_option || single->is_option;
+        this->element = single->element;
+    }
+}
+
+void abnf_element::copy_nodes()
+{
+    // the other nodes aren't changed by optimize
+    const abnf_alternation* group = dynamic_cast<const abnf_alternation*>(this->element.get());
+    if(!group)
+        return;
+
+    this->element = this->parser.make_node<abnf_alternation>(*group);
+    this->element->copy_nodes();
+}
+
+void abnf_element::print(std::ostream& os) const
+{
+    assert(this->element.get());
+
+    if(this->is_option)
+    {
+        os << "[";
+        this->element->print(os);
+        os << "]";
+    }
+    else if(dynamic_cast<const abnf_alternation*>(this->element.get()))
+    {
+        os << "(";
+        this->element->print(os);
+        os << ")";
+    }
+    else
+        this->element->print(os);
+}
+
+size_t abnf_element::count_elements() const
+{
+    assert(this->element.get());
+    return 1 + this->element->count_elements();
+}
+
+bool abnf_element::get_literal(std::string& literal, bool& sensitive) const
+{
+    const abnf_vals* vals = dynamic_cast<const abnf_vals*>(this->element.get());
+    return !this->is_option && vals && vals->get_literal(literal, sensitive);
+}
+
+const abnf_concatenation* abnf_element::get_sequence() const
+{
+    const abnf_alternation* group = dynamic_cast<const abnf_alternation*>(this->element.get());
+    return (!this->is_option && group) ? group->get_sequence() : NULL;
+}
+
+void abnf_vals::print(std::ostream& os) const
+{
+    if(this->type == CHAR_VAL)
+    {
+        bool quotable = !this->sensitive;
+        for(auto it = this->char_val.begin(); it != this->char_val.end(); it++)
+            if(*it < 0x20 || *it > 0x7e || *it == '\"')
+                quotable = false;
+
+        if(quotable || this->char_val.empty())
+            os << "\"" << this->char_val << "\"";
+        else
+        {
+            os << "%x";
+            for(auto it = this->char_val.begin(); it != this->char_val.end(); it++)
+            {
+                if(it != this->char_val.begin())
+                    os << ".";
+                print_numeral(os, (unsigned char)*it);
+            }
+        }
+    }
+    else if(this->type == RANGE_VAL)
+    {
+        os << "%x";
+        print_numeral(os, this->range.first);
+        if(this->range.second != this->range.first)
+        {
+            os << "-";
+            print_numeral(os, this->range.second);
+        }
+    }
+}
+
+bool abnf_vals::get_literal(std::string& literal, bool& sensitive) const
+{
+    if(this->type == CHAR_VAL)
+    {
+        literal = this->char_val;
+        sensitive = this->sensitive;
+        return true;
+    }
+    else if(this->type == RANGE_VAL && this->range.first == this->range.second &&
+        this->range.first >= 0 && this->range.first <= 0xff)
+    {
+        literal.assign(1, (char)this->range.first);
+        sensitive = true;
+        return true;
+    }
+
+    return false;
+}
+
+void abnf_class::print(std::ostream& os) const
+{
+    // written as an alternation of ranges
+    size_t ranges = 0;
+    std::ostringstream sts;
+    for(int i = 0; i < 256; i++)
+    {
+        if(!this->bytes.test(i))
+            continue;
+        int last = i;
+        while(last < 255 && this->bytes.test(last + 1))
+            last++;
+
+        if(ranges++)
+            sts << " / ";
+        sts << "%x";
+        print_numeral(sts, i);
+        if(last != i)
+        {
+            sts << "-";
+            print_numeral(sts, last);
+        }
+        i = last;
+    }
+
+    if(ranges > 1)
+        os << "(" << sts.str() << ")";
+    else
+        os << sts.str();
+}
+
+void abnf_rulename::print(std::ostream& os) const
+{
+    assert(this->rule);
+    os << this->rule->rulename;
+}
+
+void abnf_repetition::optimize(size_t inline_limit)
+{
+    this->element.optimize(inline_limit);
+}
+
+void abnf_repetition::copy_nodes()
+{
+    this->element.copy_nodes();
+}
+
+void abnf_repetition::print(std::ostream& os) const
+{
+    if(this->has_repeat)
+    {
+        if(this->repetitions.first == this->repetitions.second && this->repetitions.first >= 0)
+            os << this->repetitions.first;
+        else
+        {
+            if(this->repetitions.first >= 0)
+                os << this->repetitions.first;
+            os << "*";
+            if(this->repetitions.second >= 0)
+                os << this->repetitions.second;
+        }
+    }
+    this->element.print(os);
+}
+
+size_t abnf_repetition::count_elements() const
+{
+    return this->element.count_elements();
+}
+
+bool abnf_repetition::get_literal(std::string& literal, bool& sensitive) const
+{
+    return !this->has_repeat && this->element.get_literal(literal, sensitive);
+}
+
+const abnf_element* abnf_repetition::get_single() const
+{
+    return this->has_repeat ? NULL : &this->element;
+}
+
+const abnf_concatenation* abnf_repetition::get_sequence() const
+{
+    return this->has_repeat ? NULL : this->element.get_sequence();
+}
+
+void abnf_concatenation::optimize(size_t inline_limit)
+{
+    this->left.optimize(inline_limit);
+    for(auto it = this->right.begin(); it != this->right.end(); it++)
+        it->optimize(inline_limit);
+    this->flatten();
+}
+
+void abnf_concatenation::flatten()
+{
+    // a group of one concatenation is spliced into this concatenation
+    std::vector<abnf_repetition> flattened;
+    flattened.push_back(this->left);
+    flattened.insert(flattened.end(), this->right.begin(), this->right.end());
+    for(size_t i = 0; i < flattened.size();)
+    {
+        const abnf_concatenation* sequence = flattened[i].get_sequence();
+        if(!sequence)
+        {
+            i++;
+            continue;
+        }
+
+        std::vector<abnf_repetition> items;
+        items.push_back(sequence->left);
+        items.insert(items.end(), sequence->right.begin(), sequence->right.end());
+        flattened.erase(flattened.begin() + i);
+        flattened.insert(flattened.begin() + i, items.begin(), items.end());
+    }
+
+    std::vector<abnf_repetition> merged;
+    merged.push_back(flattened.front());
+    for(auto it = flattened.begin() + 1; it != flattened.end(); it++)
+    {
+        std::string a, b;
+        bool a_sensitive, b_sensitive;
+        if(merged.back().get_literal(a, a_sensitive) && it->get_literal(b, b_sensitive))
+        {
+            if(a_sensitive == b_sensitive)
+            {
+                merged.back() = make_literal(this->parser, a + b, a_sensitive);
+                continue;
+            }
+            // the insensitive literal can be merged as sensitive if it has no letters
+            if(!has_letters(a_sensitive ? b : a))
+            {
+                merged.back() = make_literal(this->parser, a + b, true);
+                continue;
+            }
+        }
+        merged.push_back(*it);
+    }
+
+    this->left = merged.front();
+    this->right.assign(merged.begin() + 1, merged.end());
+}
+
+void abnf_concatenation::copy_nodes()
+{
+    this->left.copy_nodes();
+    for(auto it = this->right.begin(); it != this->right.end(); it++)
+        it->copy_nodes();
+}
+
+void abnf_concatenation::print(std::ostream& os) const
+{
+    this->left.print(os);
+    for(auto it = this->right.begin(); it != this->right.end(); it++)
+    {
+        os << " ";
+        it->print(os);
+    }
+}
+
+size_t abnf_concatenation::count_elements() const
+{
+    size_t count = this->left.count_elements();
+    for(auto it = this->right.begin(); it != this->right.end(); it++)
+        count += it->count_elements();
+    return count;
+}
+
+bool abnf_concatenation::get_literal(std::string& literal, bool& sensitive) const
+{
+    return this->left.get_literal(literal, sensitive);
+}
+
+void abnf_concatenation::strip_literal(size_t n)
+{
+    std::string literal;
+    bool sensitive;
+    bool is_literal = this->left.get_literal(literal, sensitive);
+    assert(is_literal && n <= literal.size());
+
+    if(n < literal.size() || this->right.empty())
+        this->left = make_literal(this->parser, literal.substr(n), sensitive);
+    else
+    {
+        this->left = this->right.front();
+        this->right.erase(this->right.begin());
+    }
+}
+
+const abnf_element* abnf_concatenation::get_single() const
+{
+    return this->right.empty() ? this->left.get_single() : NULL;
+}
+
+const abnf_concatenation* abnf_alternation::get_sequence() const
+{
+    return this->right.empty() ? &this->left : NULL;
+}
+
+void abnf_alternation::optimize(size_t inline_limit)
+{
+    this->left.optimize(inline_limit);
+    for(auto it = this->right.begin(); it != this->right.end(); it++)
+        it->optimize(inline_limit);
+
+    std::vector<abnf_concatenation> alternatives, factored;
+    alternatives.push_back(this->left);
+    alternatives.insert(alternatives.end(), this->right.begin(), this->right.end());
+
+    // only adjacent alternatives can be factored because the alternatives are ordered;
+    // "ab" x / "ac" y becomes "a" ("b" x / "c" y)
+    for(size_t i = 0; i < alternatives.size();)
+    {
+        std::string prefix;
+        bool sensitive;
+        size_t j = i + 1;
+
+        if(alternatives[i].get_literal(prefix, sensitive) && !prefix.empty())
+        {
+            for(; j < alternatives.size(); j++)
+            {
+                std::string literal;
+                bool literal_sensitive;
+                if(!alternatives[j].get_literal(literal, literal_sensitive) ||
+                    literal_sensitive != sensitive)
+                    break;
+
+                size_t n = common_prefix(prefix, literal, sensitive);
+                if(n == 0)
+                    break;
+                prefix.resize(n);
+            }
+        }
+
+        if(j - i < 2)
+        {
+            factored.push_back(alternatives[i]);
+            i++;
+            continue;
+        }
+
+        boost::shared_ptr<abnf_alternation> rest = this->parser.make_node<abnf_alternation>(this->parser);
+        for(size_t k = i; k < j; k++)
+        {
+            alternatives[k].strip_literal(prefix.size());
+            if(k == i)
+                rest->left = alternatives[k];
+            else
+                rest->right.push_back(alternatives[k]);
+        }
+        rest->optimize(inline_limit);
+
+        // the rest is spliced into the prefix if it has a single alternative left
+        abnf_concatenation prefixed(this->parser, make_literal(this->parser, prefix, sensitive),
+            abnf_repetition(this->parser, abnf_element(this->parser, rest, false)));
+        prefixed.flatten();
+        factored.push_back(prefixed);
+        i = j;
+    }
+
+    this->left = factored.front();
+    this->right.assign(factored.begin() + 1, factored.end());
+}
+
+void abnf_alternation::copy_nodes()
+{
+    this->left.copy_nodes();
+    for(auto it = this->right.begin(); it != this->right.end(); it++)
+        it->copy_nodes();
+}
+
+void abnf_alternation::print(std::ostream& os) const
+{
+    this->left.print(os);
+    for(auto it = this->right.begin(); it != this->right.end(); it++)
+    {
+        os << " / ";
+        it->print(os);
+    }
+}
+
+size_t abnf_alternation::count_elements() const
+{
+    size_t count = this->left.count_elements();
+    for(auto it = this->right.begin(); it != this->right.end(); it++)
+        count += it->count_elements();
+    return count;
+}
+
+const abnf_element* abnf_alternation::get_single() const
+{
+    return this->right.empty() ? this->left.get_single() : NULL;
+}
+
+void abnf_rule::optimize(size_t inline_limit)
+{
+    assert(this->generated);
+    this->alternation.optimize(inline_limit);
+}
+
+void abnf_rule::print(std::ostream& os) const
+{
+    os << this->rulename << " = ";
+    this->alternation.print(os);
+}
+
+boost::shared_ptr<abnf_element> abnf_rule::get_inline(size_t inline_limit) const
+{
+    boost::shared_ptr<abnf_element> body;
+    if(!this->store_matched && this->alternation.count_elements() <= inline_limit)
+    {
+        boost::shared_ptr<abnf_alternation> copy = this->parser.make_node<abnf_alternation>(this->alternation);
+        copy->copy_nodes();
+        body = copy;
+    }
+    return body;
+}
+
+void abnf_parser::optimize(size_t inline_limit)
+{
+    // rules only refer to the rules added before them,
+    // so inlined rules are already optimized
+    for(auto it = this->rules.begin(); it != this->rules.end(); it++)
+        it->optimize(inline_limit);
+    this->entry.optimize(inline_limit);
+}
+
+void abnf_parser::dump(std::ostream& os) const
+{
+    for(auto it = this->rules.begin(); it != this->rules.end(); it++)
+    {
+        it->print(os);
+        os << "\n";
+    }
+    this->entry.print(os);
+    os << "\n";
+}
@@ -1,6 +1,12 @@
 #include "abnf_parser.h"
+#include "abnf_dfa.h"
+#include <algorithm>
 #include <cassert>
+#include <cstring>
+#include <cstdint>
 #include <sstream>
+#include <istream>
+#include <thread>
 
 #define EXPR_MATCHED(_matched) {if(_matched) it = jt;}
 
@@ -10,6 +16,50 @@
 #define IS_DIGIT(c) (c >= 0x30 && c <= 0x39)
 #define IS_ALPHA(c) ((c >= 0x41 && c <= 0x5a) || (c >= 0x61 && c <= 0x7a))
 
+bool match_literal(const std::string& literal, bool sensitive,
+    str_const_iterator& it, const str_const_iterator& end)
+{
+    const size_t size = literal.size();
+    if(size == 0)
+        return true;
+    if((size_t)(end - it) < size)
+        return false;
+
+    const char* pattern = literal.data();
+    const char* input = &*it;
+    size_t i = 0;
+
+    if(sensitive)
+    {
+        if(memcmp(pattern, input, size) != 0)
+            return false;
+        it += size;
+        return true;
+    }
+
+    // folds 8 bytes at a time: the 0x20 bit is set in the bytes that are in 'A'-'Z'
+    const uint64_t ones = 0x0101010101010101ull, high = ones * 0x80, low = ones * 0x7f;
+    for(; i + 8 <= size; i += 8)
+    {
+        uint64_t p, c;
+        memcpy(&p, pattern + i, 8);
+        memcpy(&c, input + i, 8);
+
+        uint64_t heptets = c & low;
+        uint64_t ge_a = heptets + ones * (0x80 - 'A');
+        uint64_t gt_z = heptets + ones * (0x80 - 'Z' - 1);
+        uint64_t upper = ge_a & ~gt_z & ~c & high;
+        if((c | (upper >> 2)) != p)
+            return false;
+    }
+    for(; i < size; i++)
+        if(fold_case(input[i]) != pattern[i])
+            return false;
+
+    it += size;
+    return true;
+}
+
 bool consume_crlf(str_const_iterator& it, const str_const_iterator& end)
 {
     str_const_iterator jt = it;
@@ -90,8 +140,24 @@ bool consume_c_wsp(str_const_iterator& it, const str_const_iterator& end)
     return true;
 }
 
-abnf_element::abnf_element(abnf_parser& parser) : parser(parser)
+abnf_element::abnf_element(abnf_parser& parser) : is_option(false), parser(parser)
+{
+}
+
+abnf_element::abnf_element(abnf_parser& parser,
+    const boost::shared_ptr<abnf_element>& element, bool is_option) :
+    element(element),
+    is_option(is_option),
+    parser(parser)
+{
+}
+
+abnf_element& abnf_element::operator=(const abnf_element& other)
 {
+    assert(&this->parser == &other.parser);
+    this->element = other.element;
+    this->is_option = other.is_option;
+    return *this;
 }
 
 bool abnf_element::generate_group_or_option(
@@ -104,7 +170,7 @@ bool abnf_element::generate_group_or_option(
 
     while(consume_c_wsp(jt, end));
 
-    this->element.reset(new abnf_alternation(this->parser));
+    this->element = this->parser.make_node<abnf_alternation>(this->parser);
     if(!this->element->generate(jt, end))
         return false;
 
@@ -124,7 +190,7 @@ bool abnf_element::generate(str_const_iterator& it, const str_const_iterator& en
     str_const_iterator jt = it;
     
     // rulename
-    this->element.reset(new abnf_rulename(this->parser));
+    this->element = this->parser.make_node<abnf_rulename>(this->parser);
     if(this->element->generate(jt, end))
     {
         EXPR_MATCHED(true);
@@ -146,7 +212,7 @@ bool abnf_element::generate(str_const_iterator& it, const str_const_iterator& en
     }
 
     // vals
-    this->element.reset(new abnf_vals(this->parser));
+    this->element = this->parser.make_node<abnf_vals>(this->parser);
     if(this->element->generate(jt, end))
     {
         EXPR_MATCHED(true);
@@ -172,6 +238,14 @@ abnf_vals::abnf_vals(abnf_parser& parser) :
 {
 }
 
+abnf_vals::abnf_vals(abnf_parser& parser, const std::string& char_val, bool sensitive) :
+    abnf_element(parser),
+    type(CHAR_VAL),
+    char_val(char_val),
+    sensitive(sensitive)
+{
+}
+
 bool abnf_vals::generate(str_const_iterator& it, const str_const_iterator& end)
 {
     str_const_iterator jt = it;
@@ -195,7 +269,7 @@ bool abnf_vals::generate(str_const_iterator& it, const str_const_iterator& end)
                 return true;
             }
             if((*jt >= 0x20 && *jt <= 0x21) || (*jt >= 0x23 && *jt <= 0x7e))
-                this->char_val += *jt;
+                this->char_val += fold_case(*jt);
             else
                 return false;
             jt++;
@@ -205,11 +279,9 @@ bool abnf_vals::generate(str_const_iterator& it, const str_const_iterator& end)
     {
         abnf_parser parser;
         matched_patterns_t out;
-        // spaces are omitted in some places to make the generation faster
-        bool add = parser.add_rule("DIGIT = \"0\"|\"1\"|\"2\"|\"3\"|\"4\"|\"5\"|\"6\"|\"7\"|\"8\"|\"9\"");
-        add = parser.add_rule("HEXDIG = DIGIT|\"A\"|\"B\"|\"C\"|\"D\"|\"E\"|\"F\"");
-        add = parser.add_rule("BIT = \"0\"|\"1\"");
-        add = parser.add_rule("DOT = \".\"");
+        // spaces are omitted in some places to make the generation faster;
+        // DIGIT, HEXDIG and BIT are core rules
+        bool add = parser.add_rule("DOT = \".\"");
         add = parser.add_rule("DASH = \"-\"");
         add = parser.add_rule("HEXSTR = 1*HEXDIG");
         add = parser.add_rule("DECSTR = 1*DIGIT");
@@ -227,9 +299,8 @@ bool abnf_vals::generate(str_const_iterator& it, const str_const_iterator& end)
             int num = -1;
             if(!out["bin-val"].empty())
             {
-                assert(false); // bin not implemented
-                parser.add_rule("STR = 1*BIT");
-                num = 0;
+                // bin not implemented
+                return false;
             }
             else if(!out["dec-val"].empty())
             {
@@ -320,7 +391,11 @@ bool abnf_vals::generate(str_const_iterator& it, const str_const_iterator& end)
                     sts >> val[i % 2];
                     i++;
                 }
-                assert(i == 2);
+                // a range without an end is a single value followed by a dash
+                // that isn't part of the num-val
+                assert(i == 1 || i == 2);
+                if(i == 1)
+                    val[1] = val[0];
 
                 this->type = RANGE_VAL;
                 this->range.first = val[0];
@@ -359,6 +434,8 @@ bool abnf_vals::generate(str_const_iterator& it, const str_const_iterator& end)
             this->type = CHAR_VAL;
             this->sensitive = false;
             this->char_val = out["STR"];
+            for(auto kt = this->char_val.begin(); kt != this->char_val.end(); kt++)
+                *kt = fold_case(*kt);
             EXPR_MATCHED(true);
             return true;
         }
@@ -371,13 +448,7 @@ bool abnf_vals::run(str_const_iterator& it, const str_const_iterator& end, match
 {
     str_const_iterator jt = it;
     if(this->type == CHAR_VAL)
-    {
-        for(auto kt = this->char_val.begin(); kt != this->char_val.end(); kt++, jt++)
-            if(jt == end || (this->sensitive ? (*kt != *jt) : (tolower(*kt) != tolower(*jt))))
-                return false;
-        EXPR_MATCHED(true);
-        return true;
-    }
+        return match_literal(this->char_val, this->sensitive, it, end);
     else if(this->type == RANGE_VAL)
     {
         if(jt == end)
@@ -439,6 +510,8 @@ bool abnf_rulename::generate(str_const_iterator& it, const str_const_iterator& e
             this->rule = &(*kt);
             break;
         }
+    if(!this->rule)
+        this->rule = this->parser.get_core_rule(rulename);
     if(!this->rule)
         return false;
 
@@ -459,10 +532,26 @@ bool abnf_rulename::run(str_const_iterator& it, const str_const_iterator& end, m
 
 abnf_repetition::abnf_repetition(abnf_parser& parser) :
     abnf_element(parser),
+    has_repeat(false),
     element(parser)
 {
 }
 
+abnf_repetition::abnf_repetition(abnf_parser& parser, const abnf_element& element) :
+    abnf_element(parser),
+    has_repeat(false),
+    element(element)
+{
+}
+
+abnf_repetition::abnf_repetition(abnf_parser& parser, const abnf_element& element, int n, int m) :
+    abnf_element(parser),
+    has_repeat(true),
+    repetitions(n, m),
+    element(element)
+{
+}
+
 bool abnf_repetition::generate_repeat(str_const_iterator& it, const str_const_iterator& end)
 {
     str_const_iterator jt = it;
@@ -549,10 +638,23 @@ bool abnf_repetition::run(str_const_iterator& it, const str_const_iterator& end,
     {
         // TODO: decide if use size_t instead of int
         int count = 0;
-        while(this->element.run(jt, end, r)) count++;
-        
-        if(count < this->repetitions.first 
-            || (count > this->repetitions.second && this->repetitions.second != -1))
+        while(count != this->repetitions.second)
+        {
+            str_const_iterator kt = jt;
+            if(!this->element.run(jt, end, r))
+                break;
+            count++;
+
+            // an empty match would repeat forever;
+            // the remaining repetitions would match empty too
+            if(jt == kt)
+            {
+                count = std::max(count, this->repetitions.first);
+                break;
+            }
+        }
+
+        if(count < this->repetitions.first)
             return false;
 
         EXPR_MATCHED(true);
@@ -562,10 +664,27 @@ bool abnf_repetition::run(str_const_iterator& it, const str_const_iterator& end,
 
 abnf_concatenation::abnf_concatenation(abnf_parser& parser) :
     abnf_element(parser),
-    left(parser)
+    left(parser),
+    right(abnf_std_allocator<abnf_repetition>(parser.get_allocator()))
 {
 }
 
+abnf_concatenation::abnf_concatenation(abnf_parser& parser, const abnf_repetition& left) :
+    abnf_element(parser),
+    left(left),
+    right(abnf_std_allocator<abnf_repetition>(parser.get_allocator()))
+{
+}
+
+abnf_concatenation::abnf_concatenation(abnf_parser& parser,
+    const abnf_repetition& left, const abnf_repetition& right) :
+    abnf_element(parser),
+    left(left),
+    right(abnf_std_allocator<abnf_repetition>(parser.get_allocator()))
+{
+    this->right.push_back(right);
+}
+
 bool abnf_concatenation::generate(str_const_iterator& it, const str_const_iterator& end)
 {
     str_const_iterator jt = it;
@@ -611,10 +730,23 @@ bool abnf_concatenation::run(str_const_iterator& it, const str_const_iterator& e
 
 abnf_alternation::abnf_alternation(abnf_parser& parser) : 
     abnf_element(parser),
-    left(parser)
+    left(parser),
+    right(abnf_std_allocator<abnf_concatenation>(parser.get_allocator()))
+{
+}
+
+abnf_alternation::abnf_alternation(abnf_parser& parser, const abnf_concatenation& left) :
+    abnf_element(parser),
+    left(left),
+    right(abnf_std_allocator<abnf_concatenation>(parser.get_allocator()))
 {
 }
 
+void abnf_alternation::add(const abnf_concatenation& alternative)
+{
+    this->right.push_back(alternative);
+}
+
 bool abnf_alternation::generate(str_const_iterator& it, const str_const_iterator& end)
 {
     str_const_iterator jt = it;
@@ -666,11 +798,25 @@ bool abnf_alternation::run(str_const_iterator& it, const str_const_iterator& end
 }
 
 abnf_rule::abnf_rule(abnf_parser& parser, bool store_matched) : 
+    generated(false),
+    store_matched(store_matched),
     parser(parser), 
     alternation(parser),
-    generated(false),
-    store_matched(store_matched)
+    incremental(false)
+{
+    this->first.nullable = false;
+}
+
+abnf_rule::abnf_rule(abnf_parser& parser, const std::string& rulename,
+    const abnf_alternation& alternation, bool store_matched) :
+    generated(true),
+    store_matched(store_matched),
+    parser(parser),
+    alternation(alternation),
+    incremental(false),
+    rulename(rulename)
 {
+    this->first.nullable = false;
 }
 
 bool abnf_rule::generate(str_const_iterator& it, const str_const_iterator& end)
@@ -717,7 +863,8 @@ bool abnf_rule::run(str_const_iterator& it, const str_const_iterator& end, match
     assert(this->generated);
     // TODO: incremental
     str_const_iterator jt = it;
-    bool matched = this->alternation.run(jt, end, out);
+    bool matched = this->dfa ?
+        this->dfa->run(jt, end) : this->alternation.run(jt, end, out);
 
     // store matched pattern and bind it to rulename
     if(this->store_matched && matched)
@@ -727,7 +874,9 @@ bool abnf_rule::run(str_const_iterator& it, const str_const_iterator& end, match
     return matched;
 }
 
-abnf_parser::abnf_parser() : entry(*this, false)
+abnf_parser::abnf_parser(abnf_allocator& allocator) :
+    allocator(&allocator),
+    entry(*this, false)
 {
 }
 
@@ -736,7 +885,10 @@ bool abnf_parser::add_rule(std::string syntax, bool store_matched)
     syntax += "\r\n";
 
     abnf_rule rule(*this, store_matched);
-    if(!rule.generate(syntax.begin(), syntax.end()))
+    str_const_iterator it = syntax.begin();
+    if(!rule.generate(it, syntax.end()))
+        return false;
+    if(!rule.analyze(this->diagnostics))
         return false;
     this->rules.push_back(rule);
 
@@ -749,12 +901,16 @@ bool abnf_parser::generate(const std::string& syntax)
     entry_syntax += syntax;
     entry_syntax += "\r\n";
 
-    return this->entry.generate(entry_syntax.begin(), entry_syntax.end());
+    str_const_iterator it = entry_syntax.begin();
+    if(!this->entry.generate(it, entry_syntax.end()))
+        return false;
+    return this->entry.analyze(this->diagnostics);
 }
 
 bool abnf_parser::run(const std::string& input, matched_patterns_t& r) const
 {
-    return this->run(input.begin(), input.end(), r);
+    str_const_iterator it = input.begin();
+    return this->run(it, input.end(), r);
 }
 
 bool abnf_parser::run(str_const_iterator& it, const str_const_iterator& end, matched_patterns_t& r) const
@@ -762,6 +918,101 @@ bool abnf_parser::run(str_const_iterator& it, const str_const_iterator& end, mat
     return this->entry.run(it, end, r);
 }
 
+size_t abnf_parser::run_record_range(str_const_iterator it, const str_const_iterator& end,
+    char delimiter, const record_callback_t& callback) const
+{
+    size_t matched_count = 0;
+    matched_patterns_t matched;
+
+    while(it != end)
+    {
+        // memchr is vectorized by the c runtime
+        const char* record = &*it;
+        const char* delim = static_cast<const char*>(memchr(record, delimiter, end - it));
+        str_const_iterator record_end = delim ? it + (delim - record) : end;
+
+        matched.clear();
+        str_const_iterator jt = it;
+        bool m = this->run(jt, record_end, matched) && jt == record_end;
+        if(m)
+            matched_count++;
+        if(callback)
+            callback(it, record_end, m, matched);
+
+        it = record_end;
+        if(it != end)
+            it++;
+    }
+
+    return matched_count;
+}
+
+size_t abnf_parser::run_records(const std::string& input, char delimiter,
+    const record_callback_t& callback, unsigned int threads) const
+{
+    if(threads <= 1 || input.size() < threads)
+        return this->run_record_range(input.begin(), input.end(), delimiter, callback);
+
+    // split the input into roughly equal chunks that start at record boundaries
+    std::vector<str_const_iterator> bounds;
+    bounds.push_back(input.begin());
+    for(unsigned int i = 1; i < threads; i++)
+    {
+        size_t pos = std::max<size_t>(input.size() / threads * i, bounds.back() - input.begin());
+        pos = input.find(delimiter, pos);
+        if(pos == std::string::npos)
+            break;
+        bounds.push_back(input.begin() + pos + 1);
+    }
+    bounds.push_back(input.end());
+
+    std::vector<size_t> counts(bounds.size() - 1, 0);
+    std::vector<std::thread> workers;
+    for(size_t i = 0; i + 1 < bounds.size(); i++)
+        workers.push_back(std::thread([&, i]()
+        {
+            counts[i] = this->run_record_range(bounds[i], bounds[i + 1], delimiter, callback);
+        }));
+
+    size_t matched_count = 0;
+    for(size_t i = 0; i < workers.size(); i++)
+    {
+        workers[i].join();
+        matched_count += counts[i];
+    }
+
+    return matched_count;
+}
+
+size_t abnf_parser::run_records(std::istream& input, char delimiter,
+    const record_callback_t& callback, unsigned int threads) const
+{
+    const size_t block_size = 1 << 20;
+    std::string buffer, tail;
+    size_t matched_count = 0;
+
+    for(;;)
+    {
+        size_t offset = buffer.size();
+        buffer.resize(offset + block_size);
+        input.read(&buffer[offset], block_size);
+        buffer.resize(offset + (size_t)input.gcount());
+
+        if(!input)
+            return matched_count + this->run_records(buffer, delimiter, callback, threads);
+
+        // the incomplete record at the end of the block is carried over to the next block
+        size_t last = buffer.rfind(delimiter);
+        if(last == std::string::npos)
+            continue;
+        tail.assign(buffer, last + 1, std::string::npos);
+        buffer.resize(last + 1);
+
+        matched_count += this->run_records(buffer, delimiter, callback, threads);
+        buffer.swap(tail);
+    }
+}
+
 abnf_rule* abnf_parser::get_rule(const std::string& rulename)
 {
     for(auto it = this->rules.begin(); it != this->rules.end(); it++)
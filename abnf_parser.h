@@ -5,14 +5,49 @@
 #include <utility>
 #include <vector>
 #include <list>
+#include <functional>
+#include <iosfwd>
+#include <bitset>
 #include <boost/shared_ptr.hpp>
+#include <boost/make_shared.hpp>
+#include "abnf_memory.h"
 
 // recursive descent parser generator that generates parsers using
 // abnf language. generated parsers only parse LL grammar.
 
 class abnf_parser;
+class abnf_program;
+class abnf_concatenation;
+class abnf_dfa;
 typedef std::string::const_iterator str_const_iterator;
 typedef std::map<std::string, std::string> matched_patterns_t;
+// called for each record of a record-delimited input; begin and end delimit
+// the record inside the input buffer and matched is true when the grammar
+// consumed the whole record
+typedef std::function<void(str_const_iterator begin, str_const_iterator end,
+    bool matched, const matched_patterns_t&)> record_callback_t;
+
+// problem found by the static analysis of a rule
+struct abnf_diagnostic
+{
+    enum severity_t {WARNING, ERROR};
+    severity_t severity;
+    std::string rulename;
+    std::string message;
+};
+
+// bytes an element can start with and whether it can match empty input
+struct abnf_first
+{
+    std::bitset<256> bytes;
+    bool nullable;
+};
+
+// case insensitive matching only folds ascii letters
+inline char fold_case(char c) {return (c >= 'A' && c <= 'Z') ? (char)(c | 0x20) : c;}
+// matches the literal at it; case insensitive literals must be folded
+bool match_literal(const std::string& literal, bool sensitive,
+    str_const_iterator& it, const str_const_iterator& end);
 
 // element encapsulates () and [] rules
 class abnf_element
@@ -27,9 +62,41 @@ protected:
     abnf_parser& parser;
 public:
     abnf_element(abnf_parser&);
+    // wraps the element into a group or an option
+    abnf_element(abnf_parser&, const boost::shared_ptr<abnf_element>&, bool is_option);
+    abnf_element(const abnf_element&) = default;
+    // elements can only be assigned within the same parser
+    abnf_element& operator=(const abnf_element&);
 
     virtual bool generate(str_const_iterator& it, const str_const_iterator& end);
     virtual bool run(str_const_iterator& it, const str_const_iterator& end, matched_patterns_t&) const;
+    // appends the instructions of this element to the program
+    virtual void compile(abnf_program&) const;
+
+    // rewrites the element into an equivalent but cheaper form;
+    // non-captured rules up to inline_limit elements are inlined
+    virtual void optimize(size_t inline_limit);
+    // replaces the group nodes the element shares with copies, so that
+    // optimizing the element doesn't change the elements it was copied from
+    virtual void copy_nodes();
+    // writes the element in abnf syntax
+    virtual void print(std::ostream&) const;
+    virtual size_t count_elements() const;
+    // adds the memory held by the element, excluding the element itself
+    virtual void measure(abnf_footprint&) const;
+    virtual size_t get_size() const {return sizeof(*this);}
+    // returns true if the element is a plain literal
+    bool get_literal(std::string& literal, bool& sensitive) const;
+    // returns the concatenation if the element is a group of one, or NULL
+    const abnf_concatenation* get_sequence() const;
+
+    // computes the first set of the element; problems are appended to diagnostics.
+    // may rewrite the element
+    virtual abnf_first analyze(std::vector<abnf_diagnostic>&, const std::string& rulename);
+    // first set of the element without the effect of []
+    abnf_first analyze_element(std::vector<abnf_diagnostic>&, const std::string& rulename);
+    bool is_optional() const {return this->is_option;}
+    void remove_option() {this->is_option = false;}
 };
 
 class abnf_repetition : public abnf_element
@@ -43,36 +110,93 @@ private:
     bool generate_repeat(str_const_iterator& it, const str_const_iterator& end);
 public:
     abnf_repetition(abnf_parser&);
+    // element without repetition
+    abnf_repetition(abnf_parser&, const abnf_element&);
+    // n*m element; negative means the value doesn't exist
+    abnf_repetition(abnf_parser&, const abnf_element&, int n, int m);
 
     bool generate(str_const_iterator& it, const str_const_iterator& end);
     bool run(str_const_iterator& it, const str_const_iterator& end, matched_patterns_t&) const;
+    void compile(abnf_program&) const;
+
+    void optimize(size_t inline_limit);
+    void copy_nodes();
+    void print(std::ostream&) const;
+    size_t count_elements() const;
+    void measure(abnf_footprint&) const;
+    size_t get_size() const {return sizeof(*this);}
+    bool get_literal(std::string& literal, bool& sensitive) const;
+    // returns the element if there's no repetition, or NULL
+    const abnf_element* get_single() const;
+    const abnf_concatenation* get_sequence() const;
+
+    // reports repetitions of elements that can match empty input
+    abnf_first analyze(std::vector<abnf_diagnostic>&, const std::string& rulename);
 };
 
 class abnf_concatenation : public abnf_element
 {
 private:
     abnf_repetition left;
-    std::vector<abnf_repetition> right;
+    std::vector<abnf_repetition, abnf_std_allocator<abnf_repetition> > right;
 public:
     abnf_concatenation(abnf_parser&);
+    explicit abnf_concatenation(abnf_parser&, const abnf_repetition& left);
+    abnf_concatenation(abnf_parser&, const abnf_repetition& left, const abnf_repetition& right);
 
     bool generate(str_const_iterator& it, const str_const_iterator& end);
     bool run(str_const_iterator& it, const str_const_iterator& end, matched_patterns_t&) const;
+    void compile(abnf_program&) const;
+
+    void optimize(size_t inline_limit);
+    // splices groups of one concatenation and merges adjacent literals
+    void flatten();
+    void copy_nodes();
+    void print(std::ostream&) const;
+    size_t count_elements() const;
+    void measure(abnf_footprint&) const;
+    size_t get_size() const {return sizeof(*this);}
+    // leading literal of the concatenation
+    bool get_literal(std::string& literal, bool& sensitive) const;
+    // removes the first n characters of the leading literal
+    void strip_literal(size_t n);
+    const abnf_element* get_single() const;
+
+    abnf_first analyze(std::vector<abnf_diagnostic>&, const std::string& rulename);
 };
 
 class abnf_alternation : public abnf_element
 {
 private:
     abnf_concatenation left;
-    std::vector<abnf_concatenation> right;
+    std::vector<abnf_concatenation, abnf_std_allocator<abnf_concatenation> > right;
 public:
     abnf_alternation(abnf_parser&);
+    abnf_alternation(abnf_parser&, const abnf_concatenation& left);
+
+    // appends an alternative
+    void add(const abnf_concatenation&);
 
     bool generate(str_const_iterator& it, const str_const_iterator& end);
     bool run(str_const_iterator& it, const str_const_iterator& end, matched_patterns_t&) const;
+    void compile(abnf_program&) const;
+
+    // factors common literal prefixes of adjacent alternatives into a trie
+    void optimize(size_t inline_limit);
+    void copy_nodes();
+    void print(std::ostream&) const;
+    size_t count_elements() const;
+    void measure(abnf_footprint&) const;
+    size_t get_size() const {return sizeof(*this);}
+    // returns the only element of the alternation, or NULL
+    const abnf_element* get_single() const;
+    // returns the only concatenation of the alternation, or NULL
+    const abnf_concatenation* get_sequence() const;
+
+    // reports alternatives that can start with the same byte
+    abnf_first analyze(std::vector<abnf_diagnostic>&, const std::string& rulename);
 };
 
-// TODO: add function to alternation to add new element
 class abnf_rule
 {
 private:
@@ -84,10 +208,16 @@ private:
     abnf_alternation alternation; // elements = alternation *c-wsp
     bool incremental; // false: '=', true: '=/'
     // TODO: defined-as tells how to run the elements
+    // runs the rule instead of the elements if set
+    boost::shared_ptr<const abnf_dfa> dfa;
+    abnf_first first;
 public:
     std::string rulename;
 
     abnf_rule(abnf_parser&, bool store_matched);
+    // rule made of elements instead of syntax
+    abnf_rule(abnf_parser&, const std::string& rulename,
+        const abnf_alternation&, bool store_matched);
 
     // elements = alternation *c-wsp
     // parses "rulename defined-as elements c-nl"
@@ -95,6 +225,23 @@ public:
     // runs the stored method using these arguments;
     // returns whether the match was successful
     bool run(str_const_iterator& it, const str_const_iterator& end, matched_patterns_t&) const;
+    // compiles the rule into a subroutine of the program
+    void compile(abnf_program&) const;
+
+    void optimize(size_t inline_limit);
+    void print(std::ostream&) const;
+    // adds the memory held by the rule, excluding the rule itself
+    void measure(abnf_footprint&) const;
+    // returns a copy of the rule elements if the rule can be inlined
+    boost::shared_ptr<abnf_element> get_inline(size_t inline_limit) const;
+
+    void set_dfa(const boost::shared_ptr<const abnf_dfa>& dfa) {this->dfa = dfa;}
+
+    // analyzes the generated rule; returns false if errors were found.
+    // rules can only refer to the rules added before them, so a rule can't
+    // be left recursive and the first sets of the referred rules are known
+    bool analyze(std::vector<abnf_diagnostic>&);
+    const abnf_first& get_first() const {return this->first;}
 };
 
 // rule names are case sensitive
@@ -111,29 +258,88 @@ public:
     // binds this rulename to the rule object
     bool generate(str_const_iterator& it, const str_const_iterator& end);
     bool run(str_const_iterator& it, const str_const_iterator& end, matched_patterns_t&) const;
+    void compile(abnf_program&) const;
+
+    // rulenames are replaced with the rule elements by the enclosing element
+    void optimize(size_t) {}
+    void print(std::ostream&) const;
+    size_t count_elements() const {return 1;}
+    void measure(abnf_footprint&) const {}
+    size_t get_size() const {return sizeof(*this);}
+    const abnf_rule* get_rule() const {return this->rule;}
+
+    abnf_first analyze(std::vector<abnf_diagnostic>&, const std::string&) {return this->rule->get_first();}
 };
 
 class abnf_parser
 {
 private:
+    abnf_allocator* allocator;
     abnf_rule entry;
+    // core rules are made when they are first referred
+    std::list<abnf_rule> core_rules;
+
+    // runs every record in [it, end); it must point to the start of a record
+    size_t run_record_range(str_const_iterator it, const str_const_iterator& end,
+        char delimiter, const record_callback_t&) const;
 public:
     std::list<abnf_rule> rules;
+    // diagnostics of the rules and the entry object; rules with errors aren't added
+    std::vector<abnf_diagnostic> diagnostics;
 
-    abnf_parser();
+    // the allocator must outlive the parser and the machines compiled from it
+    explicit abnf_parser(abnf_allocator& = abnf_allocator::get_default());
+
+    abnf_allocator& get_allocator() const {return *this->allocator;}
+    // allocates an element node with the allocator of the parser
+    template<class T, class... Args>
+    boost::shared_ptr<T> make_node(Args&&... args)
+    {
+        return boost::allocate_shared<T>(abnf_std_allocator<T>(*this->allocator),
+            std::forward<Args>(args)...);
+    }
 
     // syntax = rulename defined-as elements (no need for crlf)
-    // add rule automatically generates the rule
+    // add rule automatically generates and analyzes the rule
     bool add_rule(std::string syntax, bool store_matched = true);
     // NULL if rule not found
     abnf_rule* get_rule(const std::string& rulename);
     const abnf_rule* get_rule(const std::string& rulename) const;
+    // returns the core rule of rfc 5234 appendix b, or NULL; core rules
+    // aren't captured and are used when no added rule has the same name
+    abnf_rule* get_core_rule(const std::string& rulename);
 
     // syntax is in a form of elements
     bool generate(const std::string& syntax);
     // runs the default entry object
     bool run(const std::string& input, matched_patterns_t&) const;
     bool run(str_const_iterator& it, const str_const_iterator& end, matched_patterns_t&) const;
+
+    // splits the input on delimiter and runs the entry object on each record
+    // in place; records are distributed across the given number of threads,
+    // in which case the callback is called concurrently.
+    // returns the number of matched records
+    size_t run_records(const std::string& input, char delimiter,
+        const record_callback_t&, unsigned int threads = 1) const;
+    // reads the stream in blocks and runs the records of each block;
+    // the iterators passed to the callback are valid only during the call
+    size_t run_records(std::istream& input, char delimiter,
+        const record_callback_t&, unsigned int threads = 1) const;
+
+    // compiles the entry object and the rules it references
+    void compile(abnf_program&) const;
+
+    // optimizes the generated rules and the entry object; the match results
+    // stay the same
+    void optimize(size_t inline_limit = 32);
+    // writes the rules and the entry object in abnf syntax
+    void dump(std::ostream&) const;
+    // memory held by the rules, the entry object and the automatons
+    abnf_footprint get_footprint() const;
+
+    // compiles the rules that can be matched without backtracking into
+    // deterministic automatons; returns the number of compiled rules
+    size_t compile_dfa(size_t max_states = 4096);
 };
 
 // NOTE: numerals have 32 bit unsigned max ranges
@@ -148,7 +354,43 @@ private:
     bool sensitive;
 public:
     abnf_vals(abnf_parser&);
+    // char-val
+    abnf_vals(abnf_parser&, const std::string& char_val, bool sensitive);
 
+    // case insensitive char-vals are folded when generated
     bool generate(str_const_iterator& it, const str_const_iterator& end);
     bool run(str_const_iterator& it, const str_const_iterator& end, matched_patterns_t&) const;
+    void compile(abnf_program&) const;
+
+    void optimize(size_t) {}
+    void print(std::ostream&) const;
+    size_t count_elements() const {return 1;}
+    void measure(abnf_footprint&) const;
+    size_t get_size() const {return sizeof(*this);}
+    // single numerals are literals too
+    bool get_literal(std::string& literal, bool& sensitive) const;
+
+    abnf_first analyze(std::vector<abnf_diagnostic>&, const std::string& rulename);
+};
+
+// native matcher of a single byte; the core rules are made of these
+class abnf_class : public abnf_element
+{
+private:
+    std::bitset<256> bytes;
+public:
+    abnf_class(abnf_parser&, const std::bitset<256>&);
+
+    // classes aren't written in abnf syntax
+    bool generate(str_const_iterator&, const str_const_iterator&) {return false;}
+    bool run(str_const_iterator& it, const str_const_iterator& end, matched_patterns_t&) const;
+    void compile(abnf_program&) const;
+
+    void optimize(size_t) {}
+    void print(std::ostream&) const;
+    size_t count_elements() const {return 1;}
+    void measure(abnf_footprint&) const {}
+    size_t get_size() const {return sizeof(*this);}
+
+    abnf_first analyze(std::vector<abnf_diagnostic>&, const std::string&);
 };
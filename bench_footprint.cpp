@@ -0,0 +1,139 @@
+// memory held by rfc grammars: the footprint of the generated, optimized and
+// compiled grammar, the bytes taken from its allocator, and the peak scratch
+// memory of a machine run. the strings of a grammar are counted by the
+// footprint but come from the global heap, not from the allocator.
+//
+//   g++ -std=c++11 -O2 -pthread abnf_*.cpp bench_footprint.cpp -o bench_footprint
+//   ./bench_footprint
+
+#include "abnf_machine.h"
+#include <cstdio>
+
+namespace
+{
+
+struct grammar_t
+{
+    const char* name;
+    // rules in the order they are added
+    std::vector<std::string> rules;
+    std::vector<bool> captured;
+    const char* entry;
+    // an input the grammar matches
+    const char* input;
+};
+
+std::vector<grammar_t> make_grammars()
+{
+    std::vector<grammar_t> grammars(5);
+
+    grammars[0].name = "rfc 3986 uri";
+    grammars[0].rules.push_back("scheme = ALPHA *(ALPHA / DIGIT / \"+\" / \"-\" / \".\")");
+    grammars[0].rules.push_back("unreserved = ALPHA / DIGIT / \"-\" / \".\" / \"_\" / \"~\"");
+    grammars[0].rules.push_back("pct-encoded = \"%\" HEXDIG HEXDIG");
+    grammars[0].rules.push_back("segment = *(unreserved / pct-encoded)");
+    grammars[0].rules.push_back("path = *(\"/\" segment)");
+    grammars[0].captured.assign(grammars[0].rules.size(), true);
+    grammars[0].captured[1] = false;
+    grammars[0].entry = "scheme \":\" path [\"?\" segment]";
+    grammars[0].input = "http:/a%2Fb/c?x=1";
+
+    grammars[1].name = "rfc 7230 request line";
+    grammars[1].rules.push_back("tchar = \"!\" / \"#\" / \"$\" / \"%\" / \"&\" / \"'\" / \"*\" / \"+\" / \"-\" / "
+        "\".\" / \"^\" / \"_\" / \"`\" / \"|\" / \"~\" / DIGIT / ALPHA");
+    grammars[1].rules.push_back("method = 1*tchar");
+    grammars[1].rules.push_back("request-target = 1*%x21-7E");
+    grammars[1].rules.push_back("HTTP-version = %x48.54.54.50 \"/\" DIGIT \".\" DIGIT");
+    grammars[1].captured.assign(grammars[1].rules.size(), true);
+    grammars[1].captured[0] = false;
+    grammars[1].entry = "method SP request-target SP HTTP-version CRLF";
+    grammars[1].input = "GET /index.html HTTP/1.1\r\n";
+
+    grammars[2].name = "rfc 5234 values";
+    grammars[2].rules.push_back("hex-val = \"x\" 1*HEXDIG [1*(\".\" 1*HEXDIG) / (\"-\" 1*HEXDIG)]");
+    grammars[2].rules.push_back("dec-val = \"d\" 1*DIGIT [1*(\".\" 1*DIGIT) / (\"-\" 1*DIGIT)]");
+    grammars[2].rules.push_back("num-val = \"%\" (hex-val / dec-val)");
+    grammars[2].rules.push_back("char-val = DQUOTE *(%x20-21 / %x23-7E) DQUOTE");
+    grammars[2].captured.assign(grammars[2].rules.size(), true);
+    grammars[2].entry = "1*((num-val / char-val) *WSP)";
+    grammars[2].input = "%x41.42 %d65-90 \"ab\"\t";
+
+    grammars[3].name = "rfc 3339 timestamp";
+    grammars[3].rules.push_back("date-fullyear = 4DIGIT");
+    grammars[3].rules.push_back("date-month = 2DIGIT");
+    grammars[3].rules.push_back("date-mday = 2DIGIT");
+    grammars[3].rules.push_back("full-date = date-fullyear \"-\" date-month \"-\" date-mday");
+    grammars[3].rules.push_back("partial-time = 2DIGIT \":\" 2DIGIT \":\" 2DIGIT [\".\" 1*DIGIT]");
+    grammars[3].rules.push_back("time-offset = \"Z\" / (\"+\" / \"-\") 2DIGIT \":\" 2DIGIT");
+    grammars[3].captured.assign(grammars[3].rules.size(), true);
+    grammars[3].entry = "full-date [\"T\" partial-time time-offset]";
+    grammars[3].input = "2024-01-31T12:30:00.5+01:00";
+
+    // literals longer than the in-place storage of a string
+    grammars[4].name = "rfc 7231 media types";
+    grammars[4].rules.push_back("media-type = \"application/x-www-form-urlencoded\" / \"application/octet-stream\" / "
+        "\"application/vnd.openxmlformats-officedocument.spreadsheetml.sheet\" / \"multipart/form-data\" / "
+        "\"text/event-stream\" / \"text/html\"");
+    grammars[4].rules.push_back("parameter = \"charset=utf-8\" / \"boundary=----WebKitFormBoundary\"");
+    grammars[4].captured.assign(grammars[4].rules.size(), true);
+    grammars[4].entry = "media-type *(\";\" *SP parameter)";
+    grammars[4].input = "multipart/form-data; boundary=----WebKitFormBoundary";
+
+    return grammars;
+}
+
+const size_t tenants = 100;
+
+void print_footprint(const char* stage, const abnf_footprint& footprint, size_t allocated)
+{
+    printf("  %-10s %7zu bytes: %6zu nodes, %6zu strings, %6zu tables; %7zu allocated\n", stage,
+        footprint.total(), footprint.nodes, footprint.strings, footprint.tables, allocated);
+}
+
+}
+
+int main()
+{
+    std::vector<grammar_t> grammars = make_grammars();
+    size_t total = 0, strings = 0;
+
+    for(size_t i = 0; i < grammars.size(); i++)
+    {
+        const grammar_t& grammar = grammars[i];
+        abnf_limited_allocator tenant;
+        abnf_parser parser(tenant);
+        for(size_t j = 0; j < grammar.rules.size(); j++)
+            parser.add_rule(grammar.rules[j], grammar.captured[j]);
+        if(!parser.generate(grammar.entry))
+        {
+            printf("%s isn't valid\n", grammar.name);
+            return 1;
+        }
+
+        printf("%s\n", grammar.name);
+        print_footprint("generated", parser.get_footprint(), tenant.get_bytes());
+        parser.optimize();
+        print_footprint("optimized", parser.get_footprint(), tenant.get_bytes());
+        size_t automatons = parser.compile_dfa();
+        abnf_footprint footprint = parser.get_footprint();
+        print_footprint("compiled", footprint, tenant.get_bytes());
+
+        abnf_machine machine(parser);
+        matched_patterns_t out;
+        abnf_machine::result_t result = machine.run(grammar.input, out);
+        const abnf_machine::stats_t& stats = machine.get_stats();
+        printf("  %zu automatons, program %zu bytes, run %s: %zu scratch, %zu capture bytes, peak %zu allocated\n",
+            automatons, machine.get_footprint().total(), result == abnf_machine::MATCHED ? "matched" : "didn't match",
+            stats.scratch_bytes, stats.capture_bytes, tenant.get_peak());
+        if(result != abnf_machine::MATCHED)
+            return 1;
+
+        total += tenant.get_bytes();
+        strings += footprint.strings;
+    }
+
+    // the grammars of the tenants of a process are independent copies
+    printf("%zu tenants of each grammar and its machine: %.1f MB allocated, %.1f MB of strings on the global heap\n",
+        tenants, (double)(total * tenants) / (1 << 20), (double)(strings * tenants) / (1 << 20));
+    return 0;
+}
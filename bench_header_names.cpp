@@ -0,0 +1,131 @@
+// speed of matching header names in mixed case. the folded literals of the
+// parser are compared with the per-byte tolower of the pattern and the input
+// the literals were matched with before, then a grammar of header names is
+// run by the tree walker and the machine.
+//
+//   g++ -std=c++11 -O2 -pthread abnf_*.cpp bench_header_names.cpp -o bench_header_names
+//   ./bench_header_names
+
+#include "abnf_machine.h"
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+
+namespace
+{
+
+const char* const header_names[] =
+{
+    // names that are prefixes of other names come after them
+    "Accept-Encoding", "Accept-Language", "Accept", "Authorization", "Cache-Control",
+    "Connection", "Content-Encoding", "Content-Length", "Content-Type", "Cookie", "Date",
+    "ETag", "Host", "If-Modified-Since", "If-None-Match", "Last-Modified", "Location",
+    "Referer", "Set-Cookie", "Transfer-Encoding", "User-Agent", "X-Forwarded-For"
+};
+const size_t header_count = sizeof(header_names) / sizeof(header_names[0]);
+const size_t rounds = 200000;
+
+typedef std::chrono::steady_clock clock_type;
+
+double ns_per_match(const clock_type::time_point& since, size_t matches)
+{
+    return std::chrono::duration<double, std::nano>(clock_type::now() - since).count() / matches;
+}
+
+bool match_tolower(const std::string& literal, str_const_iterator& it, const str_const_iterator& end)
+{
+    str_const_iterator jt = it;
+    for(auto lt = literal.begin(); lt != literal.end(); lt++, jt++)
+        if(jt == end || tolower(*lt) != tolower(*jt))
+            return false;
+    it = jt;
+    return true;
+}
+
+// the names as they are sent: canonical, lower and upper case
+std::vector<std::string> make_inputs()
+{
+    std::vector<std::string> inputs;
+    for(size_t i = 0; i < header_count; i++)
+    {
+        std::string name = header_names[i], lower = name, upper = name;
+        for(size_t j = 0; j < name.size(); j++)
+        {
+            lower[j] = (char)tolower(name[j]);
+            upper[j] = (char)toupper(name[j]);
+        }
+        inputs.push_back(name);
+        inputs.push_back(lower);
+        inputs.push_back(upper);
+    }
+    return inputs;
+}
+
+}
+
+int main()
+{
+    std::vector<std::string> inputs = make_inputs();
+    // the pattern of each input is its own name, folded as the parser folds it
+    std::vector<std::string> folded;
+    for(size_t i = 0; i < inputs.size(); i++)
+    {
+        std::string name = header_names[i / 3];
+        for(size_t j = 0; j < name.size(); j++)
+            name[j] = fold_case(name[j]);
+        folded.push_back(name);
+    }
+
+    size_t matched = 0;
+    clock_type::time_point start = clock_type::now();
+    for(size_t round = 0; round < rounds; round++)
+        for(size_t i = 0; i < inputs.size(); i++)
+        {
+            str_const_iterator it = inputs[i].begin();
+            matched += match_tolower(header_names[i / 3], it, inputs[i].end());
+        }
+    printf("tolower literal:   %6.1f ns per name\n", ns_per_match(start, rounds * inputs.size()));
+
+    start = clock_type::now();
+    for(size_t round = 0; round < rounds; round++)
+        for(size_t i = 0; i < inputs.size(); i++)
+        {
+            str_const_iterator it = inputs[i].begin();
+            matched += match_literal(folded[i], false, it, inputs[i].end());
+        }
+    printf("folded literal:    %6.1f ns per name\n", ns_per_match(start, rounds * inputs.size()));
+
+    std::string rule = "field-name = ";
+    for(size_t i = 0; i < header_count; i++)
+        rule += std::string(i ? " / \"" : "\"") + header_names[i] + "\"";
+    abnf_parser parser;
+    parser.add_rule(rule);
+    parser.generate("field-name");
+    abnf_machine machine(parser);
+
+    const size_t grammar_rounds = rounds / 10;
+    matched_patterns_t out;
+    start = clock_type::now();
+    for(size_t round = 0; round < grammar_rounds; round++)
+        for(size_t i = 0; i < inputs.size(); i++)
+        {
+            str_const_iterator it = inputs[i].begin();
+            matched += parser.run(it, inputs[i].end(), out);
+        }
+    printf("tree walker:       %6.1f ns per name\n", ns_per_match(start, grammar_rounds * inputs.size()));
+
+    start = clock_type::now();
+    for(size_t round = 0; round < grammar_rounds; round++)
+        for(size_t i = 0; i < inputs.size(); i++)
+            matched += (machine.run(inputs[i], out) == abnf_machine::MATCHED);
+    printf("machine:           %6.1f ns per name\n", ns_per_match(start, grammar_rounds * inputs.size()));
+
+    // every name matches in each of the four runs
+    size_t expected = 2 * rounds * inputs.size() + 2 * grammar_rounds * inputs.size();
+    if(matched != expected)
+    {
+        printf("%zu of %zu names matched\n", matched, expected);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,91 @@
+// reparse cost of a document of key=value items after a one byte edit in
+// the middle. the steps of the reparse only grow with the logarithm of the
+// size of the document; the run fails if they grow faster.
+//
+//   g++ -std=c++11 -O2 -pthread abnf_*.cpp bench_reparse.cpp -o bench_reparse
+//   ./bench_reparse
+
+#include "abnf_machine.h"
+#include <cstdio>
+
+namespace
+{
+
+struct measure_t
+{
+    size_t size, full_steps, reparse_steps, results;
+    double edit_ms, reparse_ms, full_ms;
+};
+
+double elapsed_ms(const abnf_machine::clock_t::time_point& since)
+{
+    return std::chrono::duration<double, std::milli>(abnf_machine::clock_t::now() - since).count();
+}
+
+bool measure(const abnf_parser& parser, size_t size, measure_t& m)
+{
+    std::string text;
+    for(size_t i = 0; text.size() < size; i++)
+    {
+        char item[32];
+        snprintf(item, sizeof(item), "key%c=%u;", (char)('a' + i % 26), (unsigned int)i);
+        text += item;
+    }
+
+    matched_patterns_t matched;
+    abnf_document document(parser, text);
+    abnf_machine::clock_t::time_point start = abnf_machine::clock_t::now();
+    if(document.parse(matched) != abnf_machine::MATCHED)
+        return false;
+    m.full_ms = elapsed_ms(start);
+    m.full_steps = document.get_machine().get_stats().steps;
+
+    // replaces a digit of the middle item
+    size_t offset = text.find(';', text.size() / 2) - 1;
+    start = abnf_machine::clock_t::now();
+    document.edit(offset, 1, "7");
+    m.edit_ms = elapsed_ms(start);
+
+    start = abnf_machine::clock_t::now();
+    if(document.parse(matched) != abnf_machine::MATCHED)
+        return false;
+    m.reparse_ms = elapsed_ms(start);
+    m.reparse_steps = document.get_machine().get_stats().steps;
+    m.results = document.get_memo().count_results();
+    m.size = document.get_text().size();
+    return true;
+}
+
+}
+
+int main()
+{
+    abnf_parser parser;
+    parser.add_rule("item = 1*ALPHA \"=\" 1*DIGIT \";\"");
+    parser.add_rule("document = *item");
+    parser.generate("document");
+
+    static const size_t sizes[] = {10 << 10, 100 << 10, 1 << 20};
+    measure_t first = {};
+    for(size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+    {
+        measure_t m;
+        if(!measure(parser, sizes[i], m))
+        {
+            printf("the document didn't match\n");
+            return 1;
+        }
+        printf("%8zu bytes: full run %zu steps %.2f ms, edit %.3f ms, reparse %zu steps %.3f ms, %zu results\n",
+            m.size, m.full_steps, m.full_ms, m.edit_ms, m.reparse_steps, m.reparse_ms, m.results);
+
+        if(!i)
+            first = m;
+        // 100 times the document may take a few more halvings of the loop
+        else if(m.reparse_steps > first.reparse_steps * 2)
+        {
+            printf("the reparse steps grow with the document\n");
+            return 1;
+        }
+    }
+    return 0;
+}
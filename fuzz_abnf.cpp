@@ -0,0 +1,177 @@
+// differential fuzzer of the execution engines. the corpus files given as
+// arguments are replayed, then random and mutated grammars are run on random
+// inputs; the inputs the engines disagree on fail the run.
+//
+//   g++ -std=c++11 -O2 -pthread abnf_*.cpp fuzz_abnf.cpp -o fuzz_abnf
+//   ./fuzz_abnf fuzz_corpus/*.abnf
+//   ./fuzz_abnf -seed 7 -grammars 100000 -out found.abnf
+//
+// with ABNF_LIBFUZZER defined the file is a libfuzzer target instead. the
+// first four bytes of the fuzzer input choose the grammar and the rest is
+// the input of the grammar:
+//
+//   clang++ -std=c++11 -g -O1 -fsanitize=fuzzer,address -DABNF_LIBFUZZER abnf_*.cpp fuzz_abnf.cpp -o fuzz_abnf
+
+#include "abnf_differential.h"
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+namespace
+{
+
+abnf_differential::grammar_t make_grammar(std::mt19937& rng, size_t index)
+{
+    static const std::vector<abnf_differential::grammar_t> seeds = abnf_differential::seed_grammars();
+    if(index % 2)
+        return abnf_differential::random_grammar(rng);
+    return abnf_differential::mutate_grammar(rng, seeds[(index / 2) % seeds.size()]);
+}
+
+void print_case(const abnf_differential::case_t& c, std::ostream& os)
+{
+    abnf_differential printer;
+    printer.corpus.push_back(c);
+    printer.write_corpus(os);
+}
+
+}
+
+#ifdef ABNF_LIBFUZZER
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size)
+{
+    static abnf_differential differential;
+    if(size < 4)
+        return 0;
+
+    uint32_t seed;
+    memcpy(&seed, data, sizeof(seed));
+    std::mt19937 rng(seed);
+    if(!differential.load(make_grammar(rng, seed)))
+        return 0;
+
+    abnf_differential::report_t report = differential.run(std::string(data + 4, data + size));
+    if(!report.agreed)
+    {
+        for(auto it = differential.corpus.begin(); it != differential.corpus.end(); it++)
+            print_case(*it, std::cerr);
+        abort();
+    }
+
+    // the timing outliers of a fuzzer run aren't interesting
+    differential.corpus.clear();
+    return 0;
+}
+
+#else
+
+int main(int argc, char** argv)
+{
+    unsigned int seed = 1;
+    size_t grammars = 0, inputs = 20, max_size = 32;
+    bool fuzz = true;
+    const char* out = NULL;
+    std::vector<const char*> files;
+
+    for(int i = 1; i < argc; i++)
+    {
+        if(i + 1 < argc && strcmp(argv[i], "-seed") == 0)
+            seed = (unsigned int)strtoul(argv[++i], NULL, 10);
+        else if(i + 1 < argc && strcmp(argv[i], "-grammars") == 0)
+            grammars = strtoul(argv[++i], NULL, 10);
+        else if(i + 1 < argc && strcmp(argv[i], "-inputs") == 0)
+            inputs = strtoul(argv[++i], NULL, 10);
+        else if(i + 1 < argc && strcmp(argv[i], "-out") == 0)
+            out = argv[++i];
+        else if(argv[i][0] == '-')
+        {
+            std::cerr << "usage: " << argv[0] <<
+                " [-seed n] [-grammars n] [-inputs n] [-out corpus] [corpus files]" << std::endl;
+            return 2;
+        }
+        else
+        {
+            files.push_back(argv[i]);
+            fuzz = false;
+        }
+    }
+    // corpus files alone are only replayed
+    if(!grammars && fuzz)
+        grammars = 1000;
+
+    abnf_differential differential;
+    size_t replayed = 0, disagreements = 0;
+
+    for(auto it = files.begin(); it != files.end(); it++)
+    {
+        std::ifstream is(*it);
+        if(!is)
+        {
+            std::cerr << *it << ": can't open" << std::endl;
+            return 2;
+        }
+
+        std::vector<abnf_differential::case_t> cases = abnf_differential::read_corpus(is);
+        for(auto jt = cases.begin(); jt != cases.end(); jt++, replayed++)
+        {
+            if(!differential.load(jt->grammar))
+            {
+                std::cerr << *it << ": grammar doesn't load" << std::endl;
+                print_case(*jt, std::cerr);
+                disagreements++;
+                continue;
+            }
+            abnf_differential::report_t report = differential.run(jt->input);
+            if(!report.agreed)
+            {
+                std::cerr << *it << ": " << abnf_differential::get_engine_name(report.engine) <<
+                    " disagrees" << std::endl;
+                print_case(*jt, std::cerr);
+                disagreements++;
+            }
+        }
+    }
+
+    std::mt19937 rng(seed);
+    size_t loaded = 0;
+    for(size_t i = 0; i < grammars; i++)
+    {
+        abnf_differential::grammar_t grammar = make_grammar(rng, i);
+        if(!differential.load(grammar))
+            continue;
+        loaded++;
+
+        std::string alphabet = abnf_differential::get_alphabet(grammar);
+        for(size_t j = 0; j < inputs; j++)
+        {
+            std::string input = abnf_differential::random_input(rng, alphabet, max_size);
+            abnf_differential::report_t report = differential.run(input);
+            if(!report.agreed)
+            {
+                abnf_differential::case_t c;
+                c.grammar = grammar;
+                c.input = input;
+                c.reason = std::string(abnf_differential::get_engine_name(report.engine)) + " disagrees";
+                print_case(c, std::cerr);
+                disagreements++;
+            }
+        }
+    }
+
+    std::cout << replayed << " cases replayed, " << loaded << " of " << grammars <<
+        " grammars fuzzed, " << disagreements << " disagreements, " <<
+        differential.corpus.size() << " cases kept" << std::endl;
+
+    if(out)
+    {
+        std::ofstream os(out);
+        differential.write_corpus(os);
+    }
+
+    return disagreements ? 1 : 0;
+}
+
+#endif